@@ -0,0 +1,78 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+/*! \defgroup bench Benchmarks
+ *  \brief Cycle counting of the firmware under simavr
+ *
+ *  The benchmark firmware (bench_main.c) is the normal firmware with
+ *  another main function. It brackets each measured piece of code
+ *  with writes to the otherwise unused GPIOR0 register: the id of the
+ *  measurement before, and #BENCH_END after. The simavr host program
+ *  (bench_host.c) watches these writes and turns the cycle counts
+ *  between them into a report.
+ *
+ *  This header is shared by the firmware and the host program.
+ */
+
+/*! \addtogroup bench
+ *  @{
+ */
+
+/*! \brief Data space address of GPIOR0 on the ATtiny48 and ATtiny88.
+ */
+#define BENCH_MARKER_ADDR 0x3e
+
+/*! \brief Number of times each function is run.
+ *
+ *  The host reports the average.
+ */
+#define BENCH_REPEAT 16
+
+/*! \brief Number of #rotate_right opcodes in the script that times
+ *         the dispatch of the \ref script interpreter.
+ *
+ *  The script ends with a #SCRIPT_SHOW, so it runs one more opcode.
+ */
+#define BENCH_SCRIPT_OPS 8
+
+/*! \brief Number of PWM frames to time.
+ */
+#define BENCH_FRAMES 8
+
+/*! \brief Marker values written to GPIOR0.
+ *
+ *  BENCH_END ends the current measurement. BENCH_EMPTY measures
+ *  nothing, and gives the overhead of the markers themselves.
+ *  BENCH_SWITCH marks the start of an effect, and BENCH_EFFECTS the
+ *  point where the firmware starts running effects.
+ */
+enum bench_marker {
+    BENCH_END = 0,
+    BENCH_EMPTY,
+    BENCH_CLEAR,
+    BENCH_RAMP_RIGHT,
+    BENCH_RAMP_LEFT,
+    BENCH_TRIANGLE,
+    BENCH_RAMP_RIGHT_DIV,
+    BENCH_RAMP_LEFT_DIV,
+    BENCH_TRIANGLE_DIV,
+    BENCH_DRAW_GAUSSIAN,
+    BENCH_ROTATE_RIGHT,
+    BENCH_ROTATE_LEFT,
+    BENCH_SHIFT_RIGHT,
+    BENCH_SHIFT_LEFT,
+    BENCH_FLIP,
+    BENCH_WAVE_RENDER,
+    BENCH_SPRITE_RENDER,
+    BENCH_SCRIPT,
+    BENCH_CLIP_HEARTBEAT,
+    BENCH_CLIP_TWINKLE,
+    BENCH_FRAME,
+    BENCH_EFFECTS,
+    BENCH_SWITCH,
+    BENCH_NUM_MARKERS
+};
+
+/*! @} */
+
+#endif
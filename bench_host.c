@@ -0,0 +1,409 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <simavr/sim_avr.h>
+#include <simavr/sim_elf.h>
+#include <simavr/sim_irq.h>
+#include <simavr/sim_interrupts.h>
+#include <simavr/avr_ioport.h>
+#include <simavr/avr_spi.h>
+
+#include "config.h"
+#include "led.h"
+#include "bench.h"
+#include "trace.h"
+
+/*! \addtogroup bench
+ *  @{
+ */
+
+/*! \file bench_host.c
+ *  \brief simavr host program that runs the benchmark firmware.
+ *
+ *  Usage: bench_host firmware.elf [trace-address trace-file]
+ *
+ *  The results are printed to stdout as one JSON object per line,
+ *  with the fields "name", "value" and "unit", so that they can be
+ *  compared between builds.
+ *
+ *  For firmware built with #TRACE, the ring buffer is written to
+ *  trace-file at the end, for "trace_decode -d". Its address is that
+ *  of the trace symbol, e.g. from "avr-nm firmware.elf".
+ *
+ *  For firmware built with #LED_SPI (build this program with the same
+ *  CDEFS), the SPI output and the latch pin drive a simulated chain
+ *  of 74HC595 shift registers. Latches after some other number of
+ *  bytes than the length of the chain are reported as errors, and the
+ *  shortest and longest time between latches is reported: the
+ *  shortest should be one timer count, and the longest 128. The most
+ *  LEDs lit at once gives the current the chain must supply.
+ */
+
+#ifndef F_CPU
+#define F_CPU 8000000
+#endif
+
+/*! \brief The simavr core to run the firmware on.
+ *
+ *  The Makefile passes its MCU setting, so that e.g. the ATtiny88 of
+ *  the #LED_SPI configuration is simulated as such.
+ */
+#ifndef BENCH_MCU
+#define BENCH_MCU "attiny48"
+#endif
+
+/*! \brief File internal number of button presses to time.
+ */
+#define NUM_PRESSES 8
+
+/*! \brief File internal time between button presses.
+ */
+#define PRESS_INTERVAL (F_CPU / 2)
+
+/*! \brief File internal time the button is held down.
+ */
+#define PRESS_LENGTH (F_CPU / 20)
+
+#define STR_(x) #x
+#define STR(x) STR_(x)
+
+static const char *marker_names[BENCH_NUM_MARKERS] = {
+    [BENCH_CLEAR] = "clear",
+    [BENCH_RAMP_RIGHT] = "ramp_right",
+    [BENCH_RAMP_LEFT] = "ramp_left",
+    [BENCH_TRIANGLE] = "triangle",
+    [BENCH_RAMP_RIGHT_DIV] = "ramp_right (division)",
+    [BENCH_RAMP_LEFT_DIV] = "ramp_left (division)",
+    [BENCH_TRIANGLE_DIV] = "triangle (division)",
+    [BENCH_DRAW_GAUSSIAN] = "draw_shape (gaussian)",
+    [BENCH_ROTATE_RIGHT] = "rotate_right",
+    [BENCH_ROTATE_LEFT] = "rotate_left",
+    [BENCH_SHIFT_RIGHT] = "shift_right",
+    [BENCH_SHIFT_LEFT] = "shift_left",
+    [BENCH_FLIP] = "flip",
+    [BENCH_WAVE_RENDER] = "wave_render",
+    [BENCH_SPRITE_RENDER] = "sprite_render",
+    [BENCH_SCRIPT] = "script_step",
+    [BENCH_CLIP_HEARTBEAT] = "clip_step (heartbeat)",
+    [BENCH_CLIP_TWINKLE] = "clip_step (twinkle)",
+};
+
+/*! \brief File internal state of the measurements.
+ */
+static uint8_t marker;
+static avr_cycle_count_t marker_cycle;
+static avr_cycle_count_t marker_total[BENCH_NUM_MARKERS];
+static uint32_t marker_count[BENCH_NUM_MARKERS];
+static avr_cycle_count_t isr_cycle;
+static avr_cycle_count_t isr_total;
+static uint32_t isr_vector;
+static avr_cycle_count_t event_isr_max;
+static avr_cycle_count_t effects_cycle;
+static avr_cycle_count_t press_cycle;
+static uint8_t press_isr_seen;
+static avr_cycle_count_t isr_latency_max, switch_latency_max;
+static avr_cycle_count_t isr_latency_total, switch_latency_total;
+static uint32_t isr_latency_count, switch_latency_count;
+
+#if LED_SPI
+
+/*! \brief File internal state of the simulated shift register chain.
+ *
+ *  Byte k is the kth register from the AVR.
+ */
+static uint8_t chain_shift[LED_SPI_BYTES];
+static uint8_t chain_out[LED_SPI_BYTES];
+static uint32_t chain_bytes;
+static uint32_t chain_latches, chain_errors;
+static uint16_t chain_lit_max;
+static avr_cycle_count_t latch_cycle;
+static avr_cycle_count_t latch_interval_min, latch_interval_max;
+
+/*! \brief File internal callback for each byte shifted out on the
+ *         SPI.
+ */
+static void spi_output(struct avr_irq_t *irq, uint32_t value, void *param)
+{
+    uint8_t k;
+
+    for (k = LED_SPI_BYTES - 1; k > 0; k--) {
+        chain_shift[k] = chain_shift[k - 1];
+    }
+    chain_shift[0] = value;
+    chain_bytes++;
+}
+
+/*! \brief File internal callback for changes of the latch pin.
+ *
+ *  The chain is latched on the rising edge. irq->value is still the
+ *  old level.
+ */
+static void latch_changed(struct avr_irq_t *irq, uint32_t value, void *param)
+{
+    avr_t *avr = param;
+    avr_cycle_count_t interval;
+    uint16_t lit;
+    uint8_t k;
+
+    if (!value || irq->value) {
+        return;
+    }
+    memcpy(chain_out, chain_shift, LED_SPI_BYTES);
+    lit = 0;
+    for (k = 0; k < LED_SPI_BYTES; k++) {
+        lit += __builtin_popcount(chain_out[k]);
+    }
+    if (lit > chain_lit_max) {
+        chain_lit_max = lit;
+    }
+    if (chain_bytes != LED_SPI_BYTES) {
+        chain_errors++;
+    }
+    chain_bytes = 0;
+    if (effects_cycle && latch_cycle) {
+        interval = avr->cycle - latch_cycle;
+        if (!latch_interval_min || interval < latch_interval_min) {
+            latch_interval_min = interval;
+        }
+        if (interval > latch_interval_max) {
+            latch_interval_max = interval;
+        }
+    }
+    latch_cycle = avr->cycle;
+    chain_latches++;
+}
+
+#endif
+
+static void print_result(const char *name, double value, const char *unit)
+{
+    printf("{\"name\": \"%s\", \"value\": %.1f, \"unit\": \"%s\"}\n",
+           name, value, unit);
+}
+
+static void marker_write(avr_t *avr, avr_io_addr_t addr, uint8_t v,
+                         void *param)
+{
+    if (v == BENCH_END && marker != BENCH_END) {
+        marker_total[marker] += avr->cycle - marker_cycle;
+        marker_count[marker]++;
+    } else if (v == BENCH_EFFECTS) {
+        effects_cycle = avr->cycle;
+    } else if (v == BENCH_SWITCH && press_cycle) {
+        switch_latency_total += avr->cycle - press_cycle;
+        if (avr->cycle - press_cycle > switch_latency_max) {
+            switch_latency_max = avr->cycle - press_cycle;
+        }
+        switch_latency_count++;
+        press_cycle = 0;
+    }
+    marker = v;
+    marker_cycle = avr->cycle;
+}
+
+/*! \brief File internal callback for interrupt entry and exit.
+ *
+ *  The value is the vector number when an interrupt service routine
+ *  starts, and 0 when it returns.
+ */
+static void isr_running(struct avr_irq_t *irq, uint32_t value, void *param)
+{
+    avr_t *avr = param;
+
+    if (value) {
+        isr_cycle = avr->cycle;
+        isr_vector = value;
+        // Pin change vectors are 3 (PCINT0) to 6 (PCINT3)
+        if (press_cycle && !press_isr_seen && value >= 3 && value <= 6) {
+            press_isr_seen = 1;
+            isr_latency_total += avr->cycle - press_cycle;
+            if (avr->cycle - press_cycle > isr_latency_max) {
+                isr_latency_max = avr->cycle - press_cycle;
+            }
+            isr_latency_count++;
+        }
+    } else {
+        // The LED event vector, TIMER0_COMPB, is 13
+        if (isr_vector == 13 && avr->cycle - isr_cycle > event_isr_max) {
+            event_isr_max = avr->cycle - isr_cycle;
+        }
+        if (marker == BENCH_FRAME) {
+            isr_total += avr->cycle - isr_cycle;
+        }
+    }
+}
+
+/*! \brief File internal function that writes the trace ring buffer
+ *         of the firmware to a file.
+ *
+ *  \param address The data address of the buffer, as a string. The
+ *                 0x800000 offset of avr-nm's addresses is removed.
+ */
+static int dump_trace(avr_t *avr, const char *address, const char *path)
+{
+    unsigned long addr;
+    FILE *f;
+
+    addr = strtoul(address, 0, 16) & 0xffff;
+    if (addr + TRACE_DUMP_SIZE > avr->ramend + 1) {
+        fprintf(stderr, "bench_host: bad trace address %s\n", address);
+        return 1;
+    }
+    f = fopen(path, "wb");
+    if (!f || fwrite(avr->data + addr, TRACE_DUMP_SIZE, 1, f) != 1) {
+        perror(path);
+        return 1;
+    }
+    fclose(f);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    elf_firmware_t firmware;
+    avr_t *avr;
+    avr_irq_t *button;
+#if LED_SPI
+    avr_irq_t *irq;
+#endif
+    avr_cycle_count_t frame_cycles;
+    avr_cycle_count_t frame_isr_cycles;
+    avr_cycle_count_t overhead;
+    avr_cycle_count_t next_press;
+    uint8_t presses;
+    uint8_t pressed;
+    int state;
+    int i;
+
+    if (argc != 2 && argc != 4) {
+        fprintf(stderr, "usage: %s firmware.elf [trace-address trace-file]\n",
+                argv[0]);
+        return 1;
+    }
+    memset(&firmware, 0, sizeof(firmware));
+    if (elf_read_firmware(argv[1], &firmware)) {
+        fprintf(stderr, "%s: cannot read %s\n", argv[0], argv[1]);
+        return 1;
+    }
+    strcpy(firmware.mmcu, BENCH_MCU);
+    firmware.frequency = F_CPU;
+    avr = avr_make_mcu_by_name(firmware.mmcu);
+    if (!avr) {
+        fprintf(stderr, "%s: simavr has no %s core\n", argv[0],
+                firmware.mmcu);
+        return 1;
+    }
+    avr_init(avr);
+    avr_load_firmware(avr, &firmware);
+
+    avr_register_io_write(avr, BENCH_MARKER_ADDR, marker_write, 0);
+    avr_irq_register_notify(avr_get_interrupt_irq(avr, AVR_INT_ANY) +
+                            AVR_INT_IRQ_RUNNING, isr_running, avr);
+    button = avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ(STR(BUTTON_PORT)[0]),
+                           BUTTON_BIT);
+    avr_raise_irq(button, 1);
+#if LED_SPI
+    irq = avr_io_getirq(avr, AVR_IOCTL_SPI_GETIRQ(0), SPI_IRQ_OUTPUT);
+    if (!irq) {
+        fprintf(stderr, "%s: simavr has no SPI for %s\n", argv[0],
+                firmware.mmcu);
+        return 1;
+    }
+    avr_irq_register_notify(irq, spi_output, 0);
+    irq = avr_io_getirq(avr,
+                        AVR_IOCTL_IOPORT_GETIRQ(STR(LED_LATCH_PORT)[0]),
+                        LED_LATCH_BIT);
+    avr_irq_register_notify(irq, latch_changed, avr);
+#endif
+
+    presses = 0;
+    pressed = 0;
+    next_press = 0;
+    for (;;) {
+        state = avr_run(avr);
+        if (state == cpu_Done || state == cpu_Crashed) {
+            fprintf(stderr, "%s: firmware stopped\n", argv[0]);
+            return 1;
+        }
+        if (!effects_cycle) {
+            continue;
+        }
+        if (!next_press) {
+            next_press = effects_cycle + PRESS_INTERVAL;
+        }
+        if (avr->cycle >= next_press) {
+            if (presses == NUM_PRESSES) {
+                break;
+            }
+            avr_raise_irq(button, 0);
+            pressed = 1;
+            press_cycle = avr->cycle;
+            press_isr_seen = 0;
+            presses++;
+            next_press += PRESS_INTERVAL;
+        } else if (pressed &&
+                   avr->cycle >= next_press - PRESS_INTERVAL + PRESS_LENGTH) {
+            avr_raise_irq(button, 1);
+            pressed = 0;
+        }
+    }
+
+    overhead = marker_total[BENCH_EMPTY] / marker_count[BENCH_EMPTY];
+    for (i = 0; i < BENCH_NUM_MARKERS; i++) {
+        if (marker_names[i] && marker_count[i]) {
+            print_result(marker_names[i],
+                         (double)marker_total[i] / marker_count[i] - overhead,
+                         "cycles");
+        }
+    }
+    // The script is rotate_right opcodes and a show, so the rest is
+    // the interpreter
+    print_result("script_dispatch_per_op",
+                 ((double)marker_total[BENCH_SCRIPT] /
+                  marker_count[BENCH_SCRIPT] - overhead -
+                  BENCH_SCRIPT_OPS *
+                  ((double)marker_total[BENCH_ROTATE_RIGHT] /
+                   marker_count[BENCH_ROTATE_RIGHT] - overhead)) /
+                 (BENCH_SCRIPT_OPS + 1), "cycles");
+    frame_cycles = marker_total[BENCH_FRAME] / marker_count[BENCH_FRAME];
+    frame_isr_cycles = isr_total / BENCH_FRAMES;
+    print_result("cycles_per_frame", frame_cycles, "cycles");
+    print_result("isr_cycles_per_frame", frame_isr_cycles, "cycles");
+    print_result("cpu_free", 100.0 * (frame_cycles - frame_isr_cycles) /
+                 frame_cycles, "percent");
+    // Each LED is lit once per frame
+    print_result("pwm_refresh_rate", (double)F_CPU / frame_cycles, "Hz");
+    if (event_isr_max) {
+        print_result("led_event_isr_max", event_isr_max, "cycles");
+    }
+    if (isr_latency_count) {
+        print_result("button_isr_latency_mean",
+                     (double)isr_latency_total / isr_latency_count,
+                     "cycles");
+        print_result("button_isr_latency_max", isr_latency_max, "cycles");
+    }
+    if (switch_latency_count) {
+        print_result("effect_switch_latency_mean",
+                     (double)switch_latency_total / switch_latency_count,
+                     "cycles");
+        print_result("effect_switch_latency_max", switch_latency_max,
+                     "cycles");
+        print_result("effect_switch_latency_max_frames",
+                     (double)switch_latency_max / frame_cycles, "frames");
+    }
+#if LED_SPI
+    print_result("sr_latches", chain_latches, "latches");
+    print_result("sr_chain_errors", chain_errors, "latches");
+    print_result("sr_latch_interval_min", latch_interval_min, "cycles");
+    print_result("sr_latch_interval_max", latch_interval_max, "cycles");
+    print_result("sr_leds_lit_max", chain_lit_max, "leds");
+#endif
+    if (argc == 4) {
+        return dump_trace(avr, argv[2], argv[3]);
+    }
+    return 0;
+}
+
+/*! @} */
@@ -0,0 +1,192 @@
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <stdint.h>
+
+#include "led.h"
+#include "button.h"
+#include "blink_kit.h"
+#include "power.h"
+#include "frame_clock.h"
+#include "wave.h"
+#include "script.h"
+#include "clip.h"
+#include "clip_data.h"
+#include "bench.h"
+
+/*! \addtogroup bench
+ *  @{
+ */
+
+/*! \file bench_main.c
+ *  \brief Entry point of the benchmark firmware.
+ *
+ *  The blink kit primitives are timed with interrupts disabled, so
+ *  that the PWM engine does not add to their cycle counts. Then the
+ *  PWM frames are timed, and finally the effects are run as usual so
+ *  that the host can press the button and time the effect switches.
+ */
+
+/*! \brief File internal macro that times a statement #BENCH_REPEAT
+ *         times.
+ */
+#define BENCH(marker, statement)                \
+    do {                                        \
+        uint8_t n_;                             \
+        for (n_ = 0; n_ < BENCH_REPEAT; n_++) { \
+            GPIOR0 = (marker);                  \
+            statement;                          \
+            GPIOR0 = BENCH_END;                 \
+        }                                       \
+    } while (0)
+
+/*! \brief File internal waves for timing #wave_render: two sine
+ *         layers, as in a plasma.
+ */
+static struct wave bench_waves[2] = {
+    { 0, 0, 20, WAVE_SINE },
+    { 0, 0, -7, WAVE_SINE }
+};
+
+/*! \brief File internal copy of #ramp_right as it was before
+ *         #draw_shape, with one division per LED, to compare with.
+ */
+static void ramp_right_div(uint8_t* a)
+{
+    uint8_t i;
+
+    for (i = 0; i < NUM_LEDS; i++) {
+        a[i] = (i * MAX_INTENSITY) / NUM_LEDS;
+    }
+}
+
+/*! \brief File internal copy of #ramp_left as it was before
+ *         #draw_shape.
+ */
+static void ramp_left_div(uint8_t* a)
+{
+    uint8_t i;
+
+    for (i = 0; i < NUM_LEDS; i++) {
+        a[i] = ((NUM_LEDS - i - 1) * MAX_INTENSITY) / NUM_LEDS;
+    }
+}
+
+/*! \brief File internal copy of #triangle as it was before
+ *         #draw_shape.
+ */
+static void triangle_div(uint8_t* a)
+{
+    uint8_t i;
+
+    for (i = 0; i < NUM_LEDS/2; i++) {
+        a[i] = (i * MAX_INTENSITY * 2) / NUM_LEDS;
+    }
+    for (i = NUM_LEDS/2; i < NUM_LEDS; i++) {
+        a[i] = ((NUM_LEDS - i - 1) * MAX_INTENSITY * 2) / NUM_LEDS;
+    }
+}
+
+/*! \brief File internal shape for timing #sprite_render.
+ */
+static const uint8_t bench_shape[5] PROGMEM = { 16, 40, 90, 170, 255 };
+
+/*! \brief File internal sprites for timing #sprite_render: two
+ *         sprites between LEDs, as in the comets effect.
+ */
+static struct sprite bench_sprites[2] = {
+    { bench_shape, 5, SPRITE_ADD, 0x0380, 0 },
+    { bench_shape, 5, SPRITE_MAX, 0x0640, 0 }
+};
+
+/*! \brief File internal script for timing the dispatch of
+ *         #script_step.
+ */
+static const uint8_t bench_script[] PROGMEM = {
+    SCRIPT_ROTATE_RIGHT, SCRIPT_ROTATE_RIGHT,
+    SCRIPT_ROTATE_RIGHT, SCRIPT_ROTATE_RIGHT,
+    SCRIPT_ROTATE_RIGHT, SCRIPT_ROTATE_RIGHT,
+    SCRIPT_ROTATE_RIGHT, SCRIPT_ROTATE_RIGHT,
+    SCRIPT_SHOW, 1
+};
+
+/*! \brief File internal state for running #bench_script and the
+ *         clips.
+ */
+static struct effect_state bench_state;
+
+/*! \brief File internal function that waits until the PWM engine has
+ *         shown a frame.
+ *
+ *  #display_for waits on the frame clock instead.
+ */
+static void wait_pwm_frame(void)
+{
+    uint8_t start;
+
+    start = led_frame;
+    while (led_frame == start) {
+    }
+}
+
+int main(void)
+{
+    uint8_t i;
+    uint8_t* a;
+
+    cli();
+
+    power_init();
+    led_init();
+    frame_clock_init();
+    button_init();
+    blink_kit_init();
+
+    triangle();
+    BENCH(BENCH_EMPTY, (void)0);
+    BENCH(BENCH_CLEAR, clear(MAX_INTENSITY));
+    BENCH(BENCH_RAMP_RIGHT, ramp_right());
+    BENCH(BENCH_RAMP_LEFT, ramp_left());
+    BENCH(BENCH_TRIANGLE, triangle());
+    a = get_led_array();
+    BENCH(BENCH_RAMP_RIGHT_DIV, ramp_right_div(a));
+    BENCH(BENCH_RAMP_LEFT_DIV, ramp_left_div(a));
+    BENCH(BENCH_TRIANGLE_DIV, triangle_div(a));
+    BENCH(BENCH_DRAW_GAUSSIAN,
+          draw_shape(SHAPE_GAUSSIAN, 0, NUM_LEDS << 8, 0, MAX_INTENSITY));
+    BENCH(BENCH_ROTATE_RIGHT, rotate_right());
+    BENCH(BENCH_ROTATE_LEFT, rotate_left());
+    BENCH(BENCH_SHIFT_RIGHT, shift_right(MAX_INTENSITY));
+    BENCH(BENCH_SHIFT_LEFT, shift_left(0));
+    BENCH(BENCH_FLIP, flip());
+    BENCH(BENCH_WAVE_RENDER, wave_render(bench_waves, 2));
+    BENCH(BENCH_SPRITE_RENDER, sprite_render(bench_sprites, 2));
+    BENCH(BENCH_SCRIPT, (bench_state.line = 0,
+                         script_step(&bench_state, bench_script)));
+    // Decodes the first BENCH_REPEAT frames of each clip
+    bench_state.line = 0;
+    BENCH(BENCH_CLIP_HEARTBEAT, clip_step(&bench_state, heartbeat_clip));
+    bench_state.line = 0;
+    BENCH(BENCH_CLIP_TWINKLE, clip_step(&bench_state, twinkle_clip));
+
+    sei();
+
+    // Start timing at a frame boundary
+    commit_frame();
+    wait_pwm_frame();
+    for (i = 0; i < BENCH_FRAMES; i++) {
+        GPIOR0 = BENCH_FRAME;
+        wait_pwm_frame();
+        GPIOR0 = BENCH_END;
+    }
+
+    GPIOR0 = BENCH_EFFECTS;
+    for (;;) {
+        GPIOR0 = BENCH_SWITCH;
+        run_next_effect();
+    }
+
+    return 0;
+}
+
+/*! @} */
@@ -1,4 +1,9 @@
+#include <setjmp.h>
+
+#include "hal.h"
+
 #include "blink_kit.h"
+#include "trace.h"
 #include "button.h"
 #include "effect.h"
 
@@ -7,73 +12,489 @@
  *
  */
 
-/*! \brief Limit on how many effects can be registered.
+/*! \brief Default array for #values.
  */
-#define MAX_EFFECTS 20
+uint8_t led_array[LED_FRAME_SIZE];
 
-/*! \brief Default array for #values.
+
+#if LED_DITHER
+/*! \brief The fractions of the intensities in #values.
+ *
+ *  Every operation that moves intensities around moves their
+ *  fractions with them, and every operation that sets intensities
+ *  clears their fractions.
+ */
+#define fractions (values + NUM_LEDS)
+#endif
+
+/*! \brief File internal index in #values of the leftmost LED.
+ *
+ *  The led array is a ring buffer, so that rotating and shifting it
+ *  only moves this index, no matter how many LEDs there are. The
+ *  index is passed on to the LED module by #commit_frame, and
+ *  #get_led_array moves the leftmost LED back to index 0 before
+ *  handing out the array.
+ */
+static uint8_t head;
+
+/*! \brief File internal function that gets the index in #values of
+ *         the ith LED from the left.
  */
-uint8_t led_array[NUM_LEDS];
+static inline uint8_t led_index(uint8_t i)
+{
+    // Does not overflow for more than 128 LEDs
+    if (i >= NUM_LEDS - head) {
+        return i - (NUM_LEDS - head);
+    }
+    return i + head;
+}
+
+/*! \brief File internal function that reverses the bytes from index
+ *         from up to (but not including) index to of an array.
+ */
+static void reverse_array(uint8_t* a, uint8_t from, uint8_t to)
+{
+    uint8_t temp;
+
+    while (from + 1 < to) {
+        to--;
+        temp = a[from];
+        a[from] = a[to];
+        a[to] = temp;
+        from++;
+    }
+}
+
+/*! \brief File internal function that moves the leftmost LED to
+ *         index 0 of #values.
+ *
+ *  Rotates the array in place by reversing both parts and then the
+ *  whole.
+ */
+static void unrotate(void)
+{
+    if (head == 0) {
+        return;
+    }
+    reverse_array(values, 0, head);
+    reverse_array(values, head, NUM_LEDS);
+    reverse_array(values, 0, NUM_LEDS);
+#if LED_DITHER
+    reverse_array(fractions, 0, head);
+    reverse_array(fractions, head, NUM_LEDS);
+    reverse_array(fractions, 0, NUM_LEDS);
+#endif
+    head = 0;
+}
 
 /*! \brief Array of / pointer to the LED intensities manipulated by
  *         the \ref blink_kit module.
+ *
+ *  This is the back buffer. The front buffer is the LED module's own:
+ *  the duty cycles it loads from the array at #commit_frame.
  */
 uint8_t* values;
-effect_function effects[MAX_EFFECTS];
-uint8_t effect_count;
 uint8_t current_effect;
 
+/*! \brief File internal state of the running step effect.
+ */
+static struct effect_state step_state;
+
+/*! \brief File internal flag telling whether #step_state belongs to a
+ *         step effect that was aborted before it was done.
+ */
+static uint8_t step_alive;
+
+#if TRANSITION_FRAMES
+
+/*! \brief Led arrays of the outgoing and incoming effects during a
+ *         crossfade.
+ */
+uint8_t fade_from[LED_FRAME_SIZE];
+uint8_t fade_to[LED_FRAME_SIZE];
+
+/*! \brief File internal state of the outgoing effect during a
+ *         crossfade.
+ *
+ *  The incoming effect uses #step_state, so that it just keeps
+ *  running when the crossfade ends.
+ */
+static struct effect_state from_state;
+
+/*! \brief File internal heads of #fade_from and #fade_to.
+ */
+static uint8_t from_head, to_head;
+
+/*! \brief File internal flag telling whether a crossfade is running.
+ */
+static uint8_t fading;
+
+/*! \brief File internal increment of the crossfade mix per frame,
+ *         with 16 bits of fraction.
+ */
+#define FADE_STEP ((uint16_t)(65536UL / TRANSITION_FRAMES))
+
+#if TRANSITION_FRAMES == 1
+// 65536 / 1 does not fit FADE_STEP, and one frame would not fade
+#error "A crossfade takes at least 2 frames (or 0 to turn it off)"
+#endif
+
+#endif
+
+/*! \brief File internal return point of the running effect, used by
+ *         #abort_if_pressed.
+ */
+static jmp_buf effect_return;
+
+/*! \brief File internal flag telling whether #effect_return is set.
+ */
+static uint8_t effect_running;
+
 /*! \brief Initialize global variables.
  */
 void blink_kit_init(void) {
     values = led_array;
-    effect_count = 0;
+    head = 0;
+    led_show(values, head);
     current_effect = -1;
 }
 
 /*! \brief Get the array that is currently used for the leds.
+ *
+ *  The leftmost LED is first moved to index 0, so that element i of
+ *  the array is the intensity of LED i until the next rotation or
+ *  shift.
  */
 uint8_t* get_led_array(void)
 {
+    TRACE_EVENT(TRACE_ENTER, TRACE_GET_LED_ARRAY);
+    unrotate();
+    TRACE_EVENT(TRACE_LEAVE, TRACE_GET_LED_ARRAY);
     return values;
 }
 
 /*! \brief Set the array that is currently used for the leds.
+ *
+ *  The array replaces the back buffer and is shown after the next
+ *  #commit_frame. It stays the caller's, since the LEDs never show it
+ *  directly. It must hold #LED_FRAME_SIZE bytes.
  */
 void set_led_array(uint8_t* a)
 {
     values = a;
+    head = 0;
+}
+
+/*! \brief Show the led array on the LEDs.
+ *
+ *  The array is handed to the LED module, which loads its duty
+ *  cycles at the next frame boundary and keeps showing those: that is
+ *  the front buffer. When this function returns the array is the
+ *  effect's again, holding the frame just committed, so effects go on
+ *  changing the previous frame, and a pointer from #get_led_array stays
+ *  valid across commits. The LEDs never show a frame that an effect is
+ *  in the middle of changing, and no frame is copied (except by the
+ *  LED module with #LED_DITHER, see #led_show).
+ *
+ *  This function is called by #display_for.
+ */
+void commit_frame(void)
+{
+    led_show(values, head);
+}
+
+/*! \brief File internal function that runs a step effect until it
+ *         is done.
+ *
+ *  The frames are paced here rather than by the effect, which only
+ *  says how long to show each step.
+ *
+ *  \param ticks The number of frames to show the led array for before
+ *               the next step.
+ */
+static void run_step_effect(step_function step, uint8_t ticks)
+{
+    step_alive = 1;
+    while (ticks) {
+        display_for(ticks);
+        ticks = step(&step_state);
+    }
+    step_alive = 0;
+}
+
+#if TRANSITION_FRAMES
+
+/*! \brief File internal function that mixes two intensities.
+ *
+ *  \param a The intensity at mix 0. Must be below 128.
+ *  \param b The intensity that mix 256 would give. Must be below 128.
+ *  \param mix The share of b, in 256ths.
+ *  \return The mixed intensity, with 8 bits of fraction.
+ */
+static inline uint16_t blend(uint8_t a, uint8_t b, uint8_t mix)
+{
+    uint8_t d;
+    uint16_t p;
+
+    d = b > a ? b - a : a - b;
+    // p = d * mix. The ATtiny48 has no multiplier, so shift and add,
+    // unrolled over the bits of mix. d is in the high byte, so the
+    // shifts leave the product in p.
+    p = 0;
+    if (mix & 0x01) p += d << 8;
+    p >>= 1;
+    if (mix & 0x02) p += d << 8;
+    p >>= 1;
+    if (mix & 0x04) p += d << 8;
+    p >>= 1;
+    if (mix & 0x08) p += d << 8;
+    p >>= 1;
+    if (mix & 0x10) p += d << 8;
+    p >>= 1;
+    if (mix & 0x20) p += d << 8;
+    p >>= 1;
+    if (mix & 0x40) p += d << 8;
+    p >>= 1;
+    if (mix & 0x80) p += d << 8;
+    p >>= 1;
+    return b > a ? ((uint16_t)a << 8) + p : ((uint16_t)a << 8) - p;
+}
+
+/*! \brief File internal function that fills #values with the mix of
+ *         #fade_from and #fade_to.
+ *
+ *  With #LED_DITHER the mix keeps its fraction, so the fade is
+ *  smoother than the intensity steps. The fractions of the two
+ *  effects are ignored.
+ */
+static void blend_frames(uint8_t mix)
+{
+    uint8_t i, from, to;
+    uint16_t level;
+
+    from = from_head;
+    to = to_head;
+    for (i = 0; i < NUM_LEDS; i++) {
+        level = blend(fade_from[from], fade_to[to], mix);
+#if LED_DITHER
+        values[i] = level >> 8;
+        fractions[i] = level;
+#else
+        values[i] = (level + 0x80) >> 8;
+#endif
+        if (++from == NUM_LEDS) {
+            from = 0;
+        }
+        if (++to == NUM_LEDS) {
+            to = 0;
+        }
+    }
+}
+
+/*! \brief File internal function that steps an effect of a crossfade
+ *         in its own led array.
+ */
+static uint8_t fade_step(step_function step, struct effect_state* s,
+                         uint8_t* array, uint8_t* array_head)
+{
+    uint8_t ticks;
+
+    values = array;
+    head = *array_head;
+    ticks = step(s);
+    *array_head = head;
+    return ticks;
+}
+
+/*! \brief File internal function that hands the led array of the
+ *         incoming effect over to #values when a crossfade ends.
+ *
+ *  #values must be the back buffer.
+ */
+static void end_crossfade(void)
+{
+    uint8_t i;
+
+    for (i = 0; i < LED_FRAME_SIZE; i++) {
+        values[i] = fade_to[i];
+    }
+    head = to_head;
+    fading = 0;
+}
+
+/*! \brief File internal function that fades from the step effect in
+ *         #step_state to a new one.
+ *
+ *  Both effects start from the frame now in #values and are stepped
+ *  at their own pace, while one frame at a time is blended from their
+ *  arrays. Aborting the crossfade leaves the incoming effect running.
+ *
+ *  \return The number of frames left to show the incoming effect's
+ *          current step for, or 0 if it is done.
+ */
+static uint8_t crossfade(step_function from, step_function to)
+{
+    uint8_t* out;
+    uint8_t i;
+    uint8_t from_ticks, to_ticks;
+    uint16_t frame, mix;
+
+    for (i = 0; i < LED_FRAME_SIZE; i++) {
+        fade_from[i] = values[i];
+        fade_to[i] = values[i];
+    }
+    from_head = to_head = head;
+    from_state = step_state;
+    step_state.line = 0;
+    fading = 1;
+
+    out = values;
+    from_ticks = 1;
+    to_ticks = fade_step(to, &step_state, fade_to, &to_head);
+    mix = 0;
+    for (frame = 0; to_ticks && frame < TRANSITION_FRAMES; frame++) {
+        values = out;
+        head = 0;
+        blend_frames(mix >> 8);
+        display_for(1);
+        if (from_ticks && !--from_ticks) {
+            // Stays on its last frame when done
+            from_ticks = fade_step(from, &from_state, fade_from,
+                                   &from_head);
+        }
+        if (!--to_ticks) {
+            to_ticks = fade_step(to, &step_state, fade_to, &to_head);
+        }
+        mix += FADE_STEP;
+    }
+    values = out;
+    end_crossfade();
+    return to_ticks;
 }
 
+#endif
+
 /*! \brief Run the next effect.
+ *
+ *  Returns when the effect returns or is aborted by
+ *  #abort_if_pressed.
  *
  *  This function cannot be called from within an effect. Return from
  *  the effect instead.
  */
 void run_next_effect(void)
 {
+#if TRANSITION_FRAMES
+    uint8_t last_effect;
+#endif
+    step_function step;
+    uint8_t ticks;
+    uint8_t overruns;
+
+#if TRANSITION_FRAMES
+    last_effect = current_effect;
+#endif
     current_effect++;
-    if (current_effect >= effect_count) {
+    if (current_effect >= get_effect_count()) {
         current_effect = 0;
     }
-    effects[current_effect]();
+    // Start where the last effect stopped, whatever it was doing
+    unrotate();
+    display_reset();
+    overruns = frame_overruns;
+    TRACE_EVENT(TRACE_EFFECT_START, current_effect);
+    if (!setjmp(effect_return)) {
+        effect_running = 1;
+        if (pgm_read_byte(&effect_table[current_effect].step)) {
+            step = (step_function)pgm_read_ptr(
+                &effect_table[current_effect].function);
+#if TRANSITION_FRAMES
+            if (step_alive) {
+                ticks = crossfade((step_function)pgm_read_ptr(
+                                      &effect_table[last_effect].function),
+                                  step);
+            } else
+#endif
+            {
+                step_state.line = 0;
+                ticks = step(&step_state);
+            }
+            run_step_effect(step, ticks);
+        } else {
+            step_alive = 0;
+            ((effect_function)pgm_read_ptr(
+                &effect_table[current_effect].function))();
+        }
+    }
+#if TRANSITION_FRAMES
+    if (fading) {
+        end_crossfade();
+    }
+#endif
+    effect_running = 0;
+    TRACE_EVENT(TRACE_EFFECT_END, current_effect);
+    overruns = frame_overruns - overruns;
+    if (effect_overruns[current_effect] > 255 - overruns) {
+        effect_overruns[current_effect] = 255;
+    } else {
+        effect_overruns[current_effect] += overruns;
+    }
+}
+
+/*! \brief Abort the running effect if the button has been pressed.
+ *
+ *  The effect does not return; #run_next_effect does, as if the
+ *  effect had returned after #should_exit. This is called by
+ *  #display_for after each PWM interrupt, so an effect is switched
+ *  within one frame of the button press even if it never polls
+ *  #should_exit, as long as it does not compute for longer than that
+ *  between its #display_for calls.
+ *
+ *  Outside of an effect it does nothing. Since the effect is left
+ *  wherever it waits, it must not keep state that has to be cleaned
+ *  up across #display_for calls.
+ */
+void abort_if_pressed(void)
+{
+    // Not should_exit, which would be traced at every wakeup
+    if (effect_running && button_pressed) {
+        button_pressed = 0;
+        longjmp(effect_return, 1);
+    }
 }
 
 /*! \brief Should the currenlty running effect exit?
  *
- *  This function must be polled regularly from all effects. If it
- *  returns true, the effect function must return.
+ *  If it returns true, the effect function must return. Effects need
+ *  not poll this, since #display_for aborts them when the button is
+ *  pressed, but an effect that polls it gets to return by itself.
  */
 uint8_t should_exit(void)
 {
     if (button_pressed) {
         button_pressed = 0;
+        TRACE_EVENT(TRACE_SHOULD_EXIT, 1);
         return 1;
     } else {
+        TRACE_EVENT(TRACE_SHOULD_EXIT, 0);
         return 0;
     }
 }
 
+/*! \brief File internal function that clears the fractions of all
+ *         intensities.
+ */
+static inline void clear_fractions(void)
+{
+#if LED_DITHER
+    uint8_t i;
+
+    for (i = 0; i < NUM_LEDS; i++) {
+        fractions[i] = 0;
+    }
+#endif
+}
+
 /*! \brief Reset the contents of each element of the led array to
  *         value.
  *
@@ -85,9 +506,231 @@ void clear(uint8_t value)
 {
     uint8_t i;
 
+    TRACE_EVENT(TRACE_ENTER, TRACE_CLEAR);
     for (i = 0; i < NUM_LEDS; i++) {
         values[i] = value;
     }
+    clear_fractions();
+    TRACE_EVENT(TRACE_LEAVE, TRACE_CLEAR);
+}
+
+/*! \brief File internal table of half a bell curve, from the edge to
+ *         the middle.
+ *
+ *  Entry k is the normal distribution at x = 2.5 (63.5 - k) / 63.5
+ *  standard deviations from the middle, scaled so that the edge is 0
+ *  and the middle 255. The table is stored in flash.
+ */
+static const uint8_t bell_table[64] PROGMEM =
+{
+    0, 1, 3, 4, 5, 7, 9, 11, 13, 15, 17, 20, 22, 25, 28, 31,
+    35, 38, 42, 46, 50, 54, 58, 63, 68, 73, 78, 83, 89, 94, 100, 106,
+    112, 118, 124, 130, 137, 143, 149, 156, 162, 168, 175, 181, 187, 193, 199, 204,
+    210, 215, 220, 225, 229, 233, 237, 240, 244, 246, 249, 251, 252, 254, 255, 255
+};
+
+#if MAX_INTENSITY > 31
+#error "scale_level takes intensity differences of at most 5 bits"
+#endif
+
+/*! \brief File internal function that scales an intensity difference
+ *         by x / 256, rounded.
+ *
+ *  The multiplication is unrolled over the 5 bits of the difference,
+ *  so it is only shifts and additions.
+ */
+static inline uint8_t scale_level(uint8_t x, uint8_t delta)
+{
+    uint16_t sum;
+
+    sum = 0x80;
+    if (delta & 1) {
+        sum += x;
+    }
+    if (delta & 2) {
+        sum += x << 1;
+    }
+    if (delta & 4) {
+        sum += x << 2;
+    }
+    if (delta & 8) {
+        sum += x << 3;
+    }
+    if (delta & 16) {
+        sum += (uint16_t)x << 4;
+    }
+    return sum >> 8;
+}
+
+/*! \brief File internal function that sets the intensity of a LED of
+ *         a shape, if the LED exists.
+ */
+static inline void draw_led(uint8_t led, uint8_t level)
+{
+    if (led < NUM_LEDS) {
+        led = led_index(led);
+        values[led] = level;
+#if LED_DITHER
+        fractions[led] = 0;
+#endif
+    }
+}
+
+/*! \brief File internal function that draws a straight line of
+ *         intensities from pos to pos + width (inclusive).
+ *
+ *  The intensity of each LED is that of the line at the LED, rounded
+ *  down. It is found Bresenham style: the error term grows by the
+ *  intensity difference from one LED to the next, and the intensity
+ *  is stepped each time the error passes the width. So the line takes
+ *  one addition per LED and one per intensity step, and one
+ *  multiplication to place the first LED.
+ *
+ *  See #draw_shape for the arguments.
+ */
+static void draw_line(uint16_t pos, uint16_t width, uint8_t from, uint8_t to)
+{
+    uint8_t led;
+    uint16_t t;
+    uint8_t level, delta;
+    int8_t dir;
+    uint32_t error, step;
+
+    if (width == 0) {
+        from = to;
+        width = 1;
+    }
+    // The first LED at or after pos, and its distance from pos
+    led = (pos + 255) >> 8;
+    t = ((uint16_t)led << 8) - pos;
+    if (t > width) {
+        return;
+    }
+    if (to >= from) {
+        delta = to - from;
+        dir = 1;
+    } else {
+        delta = from - to;
+        dir = -1;
+    }
+    level = from;
+    step = (uint16_t)delta << 8;
+    error = (uint32_t)delta * t;
+    if (dir < 0) {
+        // Steps down are rounded up, so that the level is rounded down
+        error += width - 1;
+    }
+    for (;;) {
+        while (error >= width) {
+            error -= width;
+            level += dir;
+        }
+        draw_led(led, level);
+        if (width - t < 256) {
+            break;
+        }
+        t += 256;
+        led++;
+        error += step;
+    }
+}
+
+/*! \brief File internal function that draws a bell curve from pos to
+ *         pos + width (inclusive).
+ *
+ *  The index in #bell_table is stepped Bresenham style like the
+ *  intensity of #draw_line: 128 table steps over the width, the first
+ *  64 going up the table and the rest back down.
+ *
+ *  See #draw_shape for the arguments.
+ */
+static void draw_bell(uint16_t pos, uint16_t width, uint8_t start, uint8_t end)
+{
+    uint8_t led;
+    uint16_t t;
+    uint8_t k, x;
+    uint8_t delta;
+    uint32_t error;
+
+    if (width == 0) {
+        width = 1;
+    }
+    led = (pos + 255) >> 8;
+    t = ((uint16_t)led << 8) - pos;
+    if (t > width) {
+        return;
+    }
+    delta = end >= start ? end - start : start - end;
+    k = 0;
+    error = (uint32_t)t << 7;
+    for (;;) {
+        while (error >= width && k < 127) {
+            error -= width;
+            k++;
+        }
+        x = pgm_read_byte(&bell_table[k < 64 ? k : 127 - k]);
+        x = scale_level(x, delta);
+        draw_led(led, end >= start ? start + x : start - x);
+        if (width - t < 256) {
+            break;
+        }
+        t += 256;
+        led++;
+        error += 128UL << 8;
+    }
+}
+
+/*! \brief Draw a shape over some of the LEDs.
+ *
+ *  The shape covers the LEDs from position pos to pos + width
+ *  (inclusive), and the other LEDs are left as they are. Positions
+ *  are in 1/256 LEDs, so shapes can be placed and moved between
+ *  LEDs. They wrap around at 256 LEDs, so a shape that starts left of
+ *  LED 0 has a position just below 65536.
+ *
+ *  - #SHAPE_RAMP goes from start at pos to end at pos + width.
+ *  - #SHAPE_TRIANGLE goes from start at the edges to end in the
+ *    middle.
+ *  - #SHAPE_PLATEAU is like SHAPE_TRIANGLE, but stays at end over the
+ *    middle half.
+ *  - #SHAPE_GAUSSIAN is a bell curve from start at the edges to end in
+ *    the middle.
+ *
+ *  Intensities are stepped from LED to LED with additions only, see
+ *  #draw_line, so no division is needed. Fractions are set to 0.
+ *
+ *  \param shape One of #shape.
+ *  \param pos The position of the left edge, in 1/256 LEDs.
+ *  \param width The width, in 1/256 LEDs.
+ *  \param start The intensity at the left edge.
+ *  \param end The intensity at the right edge or in the middle.
+ */
+void draw_shape(uint8_t shape, uint16_t pos, uint16_t width,
+                uint8_t start, uint8_t end)
+{
+    uint16_t part;
+
+    TRACE_EVENT(TRACE_ENTER, TRACE_DRAW_SHAPE);
+    switch (shape) {
+    case SHAPE_TRIANGLE:
+        part = width >> 1;
+        draw_line(pos, part, start, end);
+        draw_line(pos + part, width - part, end, start);
+        break;
+    case SHAPE_PLATEAU:
+        part = width >> 2;
+        draw_line(pos, part, start, end);
+        draw_line(pos + part, width - 2 * part, end, end);
+        draw_line(pos + width - part, part, end, start);
+        break;
+    case SHAPE_GAUSSIAN:
+        draw_bell(pos, width, start, end);
+        break;
+    default:
+        draw_line(pos, width, start, end);
+        break;
+    }
+    TRACE_EVENT(TRACE_LEAVE, TRACE_DRAW_SHAPE);
 }
 
 /*! \brief Initialize the led array to a rising ramp-shaped intensity
@@ -98,13 +741,11 @@ void clear(uint8_t value)
  *  After: [0, 1, 2, 3, 4, 5]
  */
 void ramp_right(void) {
-    uint8_t i;
-    uint16_t level;
-
-    for (i = 0; i < NUM_LEDS; i++) {
-        level = (i * MAX_INTENSITY) / NUM_LEDS;
-        values[i] = level;
-    }
+    TRACE_EVENT(TRACE_ENTER, TRACE_RAMP_RIGHT);
+    head = 0;
+    // LED i is at i * MAX_INTENSITY / NUM_LEDS
+    draw_line(0, NUM_LEDS << 8, 0, MAX_INTENSITY);
+    TRACE_EVENT(TRACE_LEAVE, TRACE_RAMP_RIGHT);
 }
 
 /*! \brief Initialize the led array to a falling ramp-shaped intensity
@@ -115,13 +756,12 @@ void ramp_right(void) {
  *  After: [5, 4, 3, 2, 1, 0]
  */
 void ramp_left(void) {
-    uint8_t i;
-    uint16_t level;
-
-    for (i = 0; i < NUM_LEDS; i++) {
-        level = ((NUM_LEDS - i - 1) * MAX_INTENSITY) / NUM_LEDS;
-        values[i] = level;
-    }
+    TRACE_EVENT(TRACE_ENTER, TRACE_RAMP_LEFT);
+    head = 0;
+    // The mirror of ramp_right, which starts at MAX_INTENSITY just
+    // left of LED 0
+    draw_line(-256, NUM_LEDS << 8, MAX_INTENSITY, 0);
+    TRACE_EVENT(TRACE_LEAVE, TRACE_RAMP_LEFT);
 }
 
 /*! \brief Initialize the led array to two mirrored ramp-shaped
@@ -133,16 +773,130 @@ void ramp_left(void) {
  */
 void triangle(void) {
     uint8_t i;
-    uint16_t level;
 
-    for (i = 0; i < NUM_LEDS/2; i++) {
-        level = (i * MAX_INTENSITY * 2) / NUM_LEDS;
-        values[i] = level;
+    TRACE_EVENT(TRACE_ENTER, TRACE_TRIANGLE);
+    head = 0;
+    // The left half rises by 2 * MAX_INTENSITY / NUM_LEDS per LED,
+    // and the right half is its mirror image
+    draw_line(0, NUM_LEDS << 7, 0, MAX_INTENSITY);
+    for (i = (NUM_LEDS + 1) / 2; i < NUM_LEDS; i++) {
+        values[i] = values[NUM_LEDS - 1 - i];
+#if LED_DITHER
+        fractions[i] = 0;
+#endif
+    }
+    TRACE_EVENT(TRACE_LEAVE, TRACE_TRIANGLE);
+}
+
+/*! \brief File internal function that interpolates from one sprite
+ *         intensity to another by f / 16, rounded.
+ *
+ *  Like #scale_level, the multiplication is unrolled into shifts and
+ *  additions, over the 4 bits of f.
+ */
+static inline uint8_t blend_step(uint8_t from, uint8_t to, uint8_t f)
+{
+    uint8_t delta;
+    uint16_t sum;
+
+    delta = to >= from ? to - from : from - to;
+    sum = 8;
+    if (f & 1) {
+        sum += delta;
+    }
+    if (f & 2) {
+        sum += delta << 1;
+    }
+    if (f & 4) {
+        sum += delta << 2;
     }
-    for (i = NUM_LEDS/2; i < NUM_LEDS; i++) {
-        level = ((NUM_LEDS - i - 1) * MAX_INTENSITY * 2) / NUM_LEDS;
-        values[i] = level;
+    if (f & 8) {
+        sum += delta << 3;
+    }
+    sum >>= 4;
+    return to >= from ? from + sum : from - sum;
+}
+
+/*! \brief Move sprites by their speeds.
+ *
+ *  Typically called once for each frame shown. Positions wrap around
+ *  at 256 LEDs, like those of #draw_shape.
+ *
+ *  \param sprites An array of n sprites.
+ *  \param n The number of sprites.
+ */
+void sprite_step(struct sprite* sprites, uint8_t n)
+{
+    uint8_t j;
+
+    for (j = 0; j < n; j++) {
+        sprites[j].pos += sprites[j].speed;
+    }
+}
+
+/*! \brief Draw sprites over the led array, in order.
+ *
+ *  A sprite between two LEDs is anti-aliased: each LED gets the
+ *  intensity of the sprite at its position, interpolated between the
+ *  two nearest intensities of the shape, so the sprite glides from
+ *  LED to LED as its position moves. The position is used in steps
+ *  of 1/16 LED. The intensities are scaled to levels, which keep
+ *  their fraction with #LED_DITHER and are rounded otherwise.
+ *
+ *  Only the width + 1 LEDs under a sprite are visited, so the cost
+ *  grows with the widths of the sprites and not with #NUM_LEDS.
+ *  Clear the array first for sprites on a dark background.
+ *
+ *  \param sprites An array of n sprites.
+ *  \param n The number of sprites.
+ */
+void sprite_render(const struct sprite* sprites, uint8_t n)
+{
+    const struct sprite* s;
+    uint8_t led, i, j, f, end;
+    uint8_t x, prev, next;
+    uint16_t level, old;
+
+    TRACE_EVENT(TRACE_ENTER, TRACE_SPRITE_RENDER);
+    for (s = sprites; s < sprites + n; s++) {
+        // The LED at or left of shape[0], and how far left, in 1/16
+        // LEDs
+        led = s->pos >> 8;
+        f = (uint8_t)s->pos >> 4;
+        // A sprite on a whole LED covers one LED less
+        end = f ? s->width + 1 : s->width;
+        prev = 0;
+        for (j = 0; j < end; j++, led++) {
+            next = j < s->width ? pgm_read_byte(&s->shape[j]) : 0;
+            x = blend_step(next, prev, f);
+            prev = next;
+            if (led >= NUM_LEDS) {
+                continue;
+            }
+            level = BYTE_TO_LEVEL(x);
+            i = led_index(led);
+#if LED_DITHER
+            old = ((uint16_t)values[i] << 8) | fractions[i];
+#else
+            old = (uint16_t)values[i] << 8;
+#endif
+            if (s->blend == SPRITE_ADD) {
+                level += old;
+                if (level > MAX_LEVEL) {
+                    level = MAX_LEVEL;
+                }
+            } else if (s->blend == SPRITE_MAX && level < old) {
+                continue;
+            }
+#if LED_DITHER
+            values[i] = level >> 8;
+            fractions[i] = level;
+#else
+            values[i] = (level + 0x80) >> 8;
+#endif
+        }
     }
+    TRACE_EVENT(TRACE_LEAVE, TRACE_SPRITE_RENDER);
 }
 
 /*! \brief Shift all intensities one step to the right, using the
@@ -155,14 +909,9 @@ void triangle(void) {
  */
 void rotate_right(void)
 {
-    uint8_t i;
-    uint8_t last;
-
-    last = values[NUM_LEDS - 1];
-    for (i = NUM_LEDS - 1; i > 0; i--) {
-        values[i] = values[i - 1];
-    }
-    values[0] = last;
+    TRACE_EVENT(TRACE_ENTER, TRACE_ROTATE_RIGHT);
+    head = head ? head - 1 : NUM_LEDS - 1;
+    TRACE_EVENT(TRACE_LEAVE, TRACE_ROTATE_RIGHT);
 }
 
 /*! \brief Shift all intensities one step to the left, using the
@@ -175,14 +924,9 @@ void rotate_right(void)
  */
 void rotate_left(void)
 {
-    uint8_t i;
-    uint8_t left;
-
-    left = values[0];
-    for (i = 1; i < NUM_LEDS; i++) {
-        values[i - 1] = values[i];
-    }
-    values[NUM_LEDS - 1] = left;
+    TRACE_EVENT(TRACE_ENTER, TRACE_ROTATE_LEFT);
+    head = (head == NUM_LEDS - 1) ? 0 : head + 1;
+    TRACE_EVENT(TRACE_LEAVE, TRACE_ROTATE_LEFT);
 }
 
 /*! \brief Get the current intensity of the rightmost LED.
@@ -193,7 +937,7 @@ void rotate_left(void)
  *  Returned: 5
  */
 uint8_t peek_right(void) {
-    return values[NUM_LEDS - 1];
+    return values[led_index(NUM_LEDS - 1)];
 }
 
 /*! \brief Get the current intensity of the leftmost LED.
@@ -204,7 +948,7 @@ uint8_t peek_right(void) {
  *  Returned: 0
  */
 uint8_t peek_left(void) {
-    return values[0];
+    return values[head];
 }
 
 /*! \brief Shift all intensities one step to the right, using the the
@@ -218,14 +962,16 @@ uint8_t peek_left(void) {
  */
 uint8_t shift_right(uint8_t left)
 {
-    uint8_t i;
     uint8_t right;
 
-    right = values[NUM_LEDS - 1];
-    for (i = NUM_LEDS - 1; i > 0; i--) {
-        values[i] = values[i - 1];
-    }
-    values[0] = left;
+    TRACE_EVENT(TRACE_ENTER, TRACE_SHIFT_RIGHT);
+    rotate_right();
+    right = values[head];
+    values[head] = left;
+#if LED_DITHER
+    fractions[head] = 0;
+#endif
+    TRACE_EVENT(TRACE_LEAVE, TRACE_SHIFT_RIGHT);
     return right;
 }
 
@@ -243,11 +989,15 @@ uint8_t shift_left(uint8_t right)
     uint8_t i;
     uint8_t left;
 
-    left = values[0];
-    for (i = 1; i < NUM_LEDS; i++) {
-        values[i - 1] = values[i];
-    }
-    values[NUM_LEDS - 1] = right;
+    TRACE_EVENT(TRACE_ENTER, TRACE_SHIFT_LEFT);
+    i = head;
+    rotate_left();
+    left = values[i];
+    values[i] = right;
+#if LED_DITHER
+    fractions[i] = 0;
+#endif
+    TRACE_EVENT(TRACE_LEAVE, TRACE_SHIFT_LEFT);
     return left;
 }
 
@@ -261,29 +1011,59 @@ uint8_t shift_left(uint8_t right)
  */
 void flip(void)
 {
-    uint8_t i, j;
-    uint8_t temp;
-    for (i = 0; i < NUM_LEDS/2; i++) {
-        j = NUM_LEDS-i-1;
-        temp = values[i];
-        values[i] = values[j];
-        values[j] = temp;
-    }
+    TRACE_EVENT(TRACE_ENTER, TRACE_FLIP);
+    reverse_array(values, 0, NUM_LEDS);
+#if LED_DITHER
+    reverse_array(fractions, 0, NUM_LEDS);
+#endif
+    // LED i was at head + i and is now at -head - i - 1
+    head = head ? NUM_LEDS - head : 0;
+    TRACE_EVENT(TRACE_LEAVE, TRACE_FLIP);
 }
 
-/*! \brief Register a new effect.
+#if LED_DITHER
+
+/*! \brief Set the level of a LED, with fraction.
  *
- *  This function should only be called once per effect and only at
- *  program initialization. When the button is pressed, the registered
- *  effects will cycled through in the order their #add_effect calls
- *  were executed during the initialization.
+ *  \param led The index of the LED.
+ *  \param level The level, from 0 to #MAX_LEVEL (inclusive).
  */
-void add_effect(effect_function effect)
+void set_level(uint8_t led, uint16_t level)
 {
-    if (effect_count != MAX_EFFECTS) {
-        effects[effect_count] = effect;
-        effect_count++;
-    }
+    led = led_index(led);
+    values[led] = level >> 8;
+    fractions[led] = level;
+}
+
+/*! \brief Get the level of a LED, with fraction.
+ */
+uint16_t get_level(uint8_t led)
+{
+    led = led_index(led);
+    return ((uint16_t)values[led] << 8) | fractions[led];
+}
+
+#endif
+
+/*! \brief Get the number of effects in #effect_table.
+ */
+uint8_t get_effect_count(void)
+{
+    return pgm_read_byte(&effect_table_size);
+}
+
+/*! \brief Get the number of frames an effect has shown late.
+ *
+ *  A frame is late when the effect takes longer than a frame of the
+ *  \ref frame_clock to compute it and get it shown (see
+ *  #display_for). The count includes the crossfade into the effect,
+ *  and stops at 255.
+ *
+ *  \param effect The index of the effect in #effect_table.
+ */
+uint8_t get_effect_overruns(uint8_t effect)
+{
+    return effect_overruns[effect];
 }
 
 /*! @} */
@@ -1,8 +1,9 @@
 #ifndef BLINK_KIT_H
 #define BLINK_KIT_H
 
-#include <avr/io.h>
+#include <stdint.h>
 #include "led.h"
+#include "frame_clock.h"
 
 /*! \defgroup blink_kit Blink Kit
  *
@@ -11,13 +12,27 @@
  *  implicitly. This array can be accessed manually using
  *  #get_led_array and be replaced using #set_led_array. Initially, a
  *  statically allocated array is used.
+ *
+ *  The array is double buffered: effects change it while the LEDs
+ *  show the duty cycles the LED module loaded from it at the last
+ *  #commit_frame (called by #display_for). The array itself is never
+ *  shown, so it is the effect's own for as long as it is used, also
+ *  when set with #set_led_array.
+ *
+ *  Internally the array is a ring buffer, which makes rotating and
+ *  shifting it cost the same for any number of LEDs. Code that
+ *  indexes the array directly must get it with #get_led_array, which
+ *  puts LED 0 back at index 0, after the last rotation or shift.
+ *
+ *  With #LED_DITHER the array also holds a fraction for each
+ *  intensity, which can be set with #set_level.
  */
 
 /*! \addtogroup blink_kit
  *  @{
  */
 
-uint8_t* values;
+extern uint8_t* values;
 
 void blink_kit_init(void);
 
@@ -25,10 +40,14 @@ uint8_t* get_led_array(void);
 
 void set_led_array(uint8_t* a);
 
+void commit_frame(void);
+
 void run_next_effect(void);
 
 uint8_t should_exit(void);
 
+void abort_if_pressed(void);
+
 void clear(uint8_t value);
 
 void ramp_right(void);
@@ -37,6 +56,41 @@ void ramp_left(void);
 
 void triangle(void);
 
+/*! \brief The shapes that #draw_shape can draw.
+ */
+enum shape {
+    SHAPE_RAMP,
+    SHAPE_TRIANGLE,
+    SHAPE_PLATEAU,
+    SHAPE_GAUSSIAN
+};
+
+void draw_shape(uint8_t shape, uint16_t pos, uint16_t width,
+                uint8_t start, uint8_t end);
+
+/*! \brief How #sprite_render combines a sprite with the LEDs under it.
+ */
+enum sprite_blend {
+    SPRITE_MAX,         //!< The brighter of the two
+    SPRITE_ADD,         //!< The sum, limited to #MAX_LEVEL
+    SPRITE_REPLACE      //!< The sprite, over the whole of its width
+};
+
+/*! \brief A shape that moves along the LEDs in steps of less than a
+ *         LED.
+ */
+struct sprite {
+    const uint8_t* shape;   //!< Intensities from 0 to 255, in flash
+    uint8_t width;          //!< Number of intensities in shape
+    uint8_t blend;          //!< One of #sprite_blend
+    uint16_t pos;           //!< Position of shape[0], in 1/256 LEDs
+    int16_t speed;          //!< Added to pos by #sprite_step
+};
+
+void sprite_step(struct sprite* sprites, uint8_t n);
+
+void sprite_render(const struct sprite* sprites, uint8_t n);
+
 void rotate_right(void);
 
 void rotate_left(void);
@@ -51,9 +105,88 @@ uint8_t shift_left(uint8_t right);
 
 void flip(void);
 
+#if LED_DITHER
+void set_level(uint8_t led, uint16_t level);
+
+uint16_t get_level(uint8_t led);
+#endif
+
 typedef void (*effect_function)(void);
 
-void add_effect (effect_function effect);
+/*! \brief State of a step effect, kept between its steps.
+ *
+ *  Local variables of a step function are lost when it returns, so
+ *  loop counters that live across #EFFECT_SHOW go in i and j.
+ */
+struct effect_state {
+    uint16_t line;  // Resume point, 0 at start
+    int8_t i, j;
+};
+
+/*! \brief A step effect.
+ *
+ *  Called once per step with the state of the effect. Changes the led
+ *  array and returns the number of frames to show it for, or 0 when
+ *  the effect is done.
+ */
+typedef uint8_t (*step_function)(struct effect_state* s);
+
+/*! \brief Start the body of a step function.
+ *
+ *  The body is resumed where it last returned, protothread style: it
+ *  is a switch on the resume point. A body can therefore not have
+ *  switch statements of its own around an #EFFECT_SHOW.
+ */
+#define EFFECT_BEGIN(s) switch ((s)->line) { case 0:
+
+/*! \brief Show the led array for the given number of frames, and
+ *         resume the step function after this line in the next step.
+ */
+#define EFFECT_SHOW(s, ticks)                   \
+    do {                                        \
+        (s)->line = __LINE__;                   \
+        return (ticks);                         \
+    case __LINE__:;                             \
+    } while (0)
+
+/*! \brief End the body of a step function, and the effect.
+ */
+#define EFFECT_END(s) } (s)->line = 0; return 0
+
+/*! \brief An entry of the effect table, #effect_table.
+ *
+ *  step tells whether function is really a #step_function.
+ */
+struct effect_entry {
+    effect_function function;
+    uint8_t step;
+};
+
+/*! \brief An #effect_entry for an #effect_function.
+ */
+#define EFFECT(f) { (f), 0 }
+
+/*! \brief An #effect_entry for a #step_function.
+ */
+#define STEP_EFFECT(f) { (effect_function)(f), 1 }
+
+/*! \brief Number of frames of the \ref frame_clock a crossfade
+ *         between two effects lasts.
+ *
+ *  When the button switches from one step effect to another, both run
+ *  for this many frames while the LEDs fade from the first to the
+ *  second. Switches from or to other effects cut directly. 0 turns
+ *  crossfades off, which saves the RAM of their two frame buffers.
+ *  Can be set from the Makefile with -DTRANSITION_FRAMES=n, with n
+ *  from 2 to 256.
+ */
+#ifndef TRANSITION_FRAMES
+#define TRANSITION_FRAMES FRAMES(250)
+#endif
+
+uint8_t get_effect_count(void);
+
+uint8_t get_effect_overruns(uint8_t effect);
 
 /*! @} */
 
@@ -1,5 +1,4 @@
-#include <avr/io.h>
-#include <avr/interrupt.h>
+#include "hal.h"
 #include "button.h"
 #include "config.h"
 #define PORT_(p) PORT##p
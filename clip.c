@@ -0,0 +1,74 @@
+#include "hal.h"
+
+#include "clip.h"
+#include "led.h"
+#include "blink_kit.h"
+#include "trace.h"
+
+#if MAX_INTENSITY >= CLIP_MAX_ARG
+#error "Clip tokens take intensities of at most 5 bits"
+#endif
+
+/*! \addtogroup clip
+ *  @{
+ */
+
+/*! \brief Decode the next frame of a clip into the led array.
+ *
+ *  Meant to be called from a step function, like #script_step: the
+ *  offset of the next token is kept in the line of the state. The
+ *  LEDs are dark when the clip starts.
+ *
+ *  \param s The state of the effect.
+ *  \param clip The tokens, in flash.
+ *  \return The number of frames to show the frame for.
+ */
+uint8_t clip_step(struct effect_state* s, const uint8_t* clip)
+{
+    const uint8_t* p;
+    uint8_t* a;
+    uint8_t led;
+    uint8_t token, arg;
+    uint8_t n;
+
+    TRACE_EVENT(TRACE_ENTER, TRACE_CLIP_STEP);
+    if (s->line == 0) {
+        clear(0);
+    }
+    a = get_led_array();
+    p = clip + s->line;
+    led = 0;
+    for (;;) {
+        token = pgm_read_byte(p++);
+        arg = token & (CLIP_MAX_ARG - 1);
+        switch (token & ~(CLIP_MAX_ARG - 1)) {
+        case CLIP_SET:
+            n = 1;
+            break;
+        case CLIP_RUN:
+            n = pgm_read_byte(p++);
+            break;
+        case CLIP_SKIP:
+            led += arg + 1;
+            continue;
+        case CLIP_SHOW:
+            s->line = p - clip;
+            TRACE_EVENT(TRACE_LEAVE, TRACE_CLIP_STEP);
+            return arg + 1;
+        default:
+            p = clip;
+            led = 0;
+            continue;
+        }
+        for (; n != 0; n--, led++) {
+            if (led < NUM_LEDS) {
+                a[led] = arg;
+#if LED_DITHER
+                a[NUM_LEDS + led] = 0;
+#endif
+            }
+        }
+    }
+}
+
+/*! @} */
@@ -0,0 +1,62 @@
+#ifndef CLIP_H
+#define CLIP_H
+
+#include <stdint.h>
+#include "blink_kit.h"
+
+/*! \defgroup clip Clip
+ *  \brief Compressed animations streamed from flash
+ *
+ *  A clip is a recorded animation, for patterns that are too costly
+ *  to compute while they are shown. It is stored in flash as a string
+ *  of tokens, which #clip_step decodes straight into the led array,
+ *  one frame per step.
+ *
+ *  Each token is a byte with an opcode in the top 3 bits and an
+ *  argument in the low 5. The tokens of a frame write the LEDs from
+ *  left to right:
+ *
+ *  - CLIP_SET v: set the next LED to intensity v.
+ *  - CLIP_RUN v, n: set the next n LEDs (1 to 255) to intensity v.
+ *  - CLIP_SKIP n: leave the next n + 1 LEDs as they are.
+ *  - CLIP_SHOW t: end the frame and show it for t + 1 frames of the
+ *    \ref frame_clock. LEDs after the last token are left as they
+ *    are.
+ *  - CLIP_LOOP: start the clip over.
+ *
+ *  A frame that skips no LED is a keyframe, and a frame that only
+ *  writes the LEDs that changed is a delta frame. The first frame of
+ *  a clip must be a keyframe, since the clip loops back to it from
+ *  its last frame. A frame that changes nothing is a single
+ *  CLIP_SHOW, which also lets a frame be held longer than 32 frames.
+ *
+ *  Clips are not written by hand: the host program clip_encode turns
+ *  a text file of frames into a clip, choosing the shorter of a
+ *  keyframe and a delta frame for each frame, and "make clips"
+ *  rebuilds clip_data.c and clip_data.h from the files in clips/.
+ */
+
+/*! \addtogroup clip
+ *  @{
+ */
+
+/*! \brief The opcodes of the clip tokens, in their top 3 bits.
+ */
+enum clip_op {
+    CLIP_SET = 0x00,
+    CLIP_RUN = 0x20,
+    CLIP_SKIP = 0x40,
+    CLIP_SHOW = 0x60,
+    CLIP_LOOP = 0x80
+};
+
+/*! \brief The longest run of a CLIP_SKIP token, and the most frames
+ *         a CLIP_SHOW token shows a frame for.
+ */
+#define CLIP_MAX_ARG 32
+
+uint8_t clip_step(struct effect_state* s, const uint8_t* clip);
+
+/*! @} */
+
+#endif
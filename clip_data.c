@@ -0,0 +1,75 @@
+/* Generated by clip_encode, do not edit. See "make clips". */
+
+#include "hal.h"
+
+#include "clip_data.h"
+
+/*! \brief Clip from clips/heartbeat.txt.
+ */
+const uint8_t heartbeat_clip[] PROGMEM = {
+    0x20, 0x06, 0x02, 0x03, 0x05, 0x05, 0x03, 0x02, 0x20, 0x06, 0x69,
+    0x41, 0x02, 0x03, 0x05, 0x06, 0x08, 0x09, 0x0b, 0x0b, 0x09, 0x08, 0x06, 0x05, 0x03, 0x02, 0x69,
+    0x04, 0x06, 0x07, 0x09, 0x0a, 0x0c, 0x0d, 0x0f, 0x10, 0x10, 0x0f, 0x0d, 0x0c, 0x0a, 0x09, 0x07, 0x06, 0x04, 0x69,
+    0x02, 0x04, 0x05, 0x07, 0x08, 0x0a, 0x0b, 0x0d, 0x0e, 0x0e, 0x0d, 0x0b, 0x0a, 0x08, 0x07, 0x05, 0x04, 0x02, 0x69,
+    0x00, 0x02, 0x03, 0x04, 0x06, 0x08, 0x09, 0x0a, 0x0c, 0x0c, 0x0a, 0x09, 0x08, 0x06, 0x04, 0x03, 0x02, 0x00, 0x69,
+    0x40, 0x00, 0x01, 0x02, 0x04, 0x05, 0x07, 0x08, 0x0a, 0x0a, 0x08, 0x07, 0x05, 0x04, 0x02, 0x01, 0x00, 0x69,
+    0x20, 0x04, 0x02, 0x03, 0x05, 0x06, 0x08, 0x08, 0x06, 0x05, 0x03, 0x02, 0x20, 0x04, 0x69,
+    0x20, 0x05, 0x01, 0x03, 0x04, 0x06, 0x06, 0x04, 0x03, 0x01, 0x00, 0x69,
+    0x20, 0x07, 0x02, 0x04, 0x04, 0x02, 0x20, 0x07, 0x69,
+    0x20, 0x08, 0x01, 0x01, 0x00, 0x69,
+    0x20, 0x12, 0x69,
+    0x69,
+    0x69,
+    0x20, 0x05, 0x01, 0x02, 0x04, 0x05, 0x05, 0x04, 0x02, 0x01, 0x69,
+    0x40, 0x01, 0x02, 0x04, 0x05, 0x07, 0x08, 0x0a, 0x0b, 0x0b, 0x0a, 0x08, 0x07, 0x05, 0x04, 0x02, 0x01, 0x69,
+    0x40, 0x00, 0x01, 0x02, 0x04, 0x05, 0x07, 0x08, 0x0a, 0x0a, 0x08, 0x07, 0x05, 0x04, 0x02, 0x01, 0x00, 0x69,
+    0x20, 0x04, 0x02, 0x03, 0x05, 0x06, 0x08, 0x08, 0x06, 0x05, 0x03, 0x02, 0x20, 0x04, 0x69,
+    0x20, 0x05, 0x02, 0x03, 0x05, 0x06, 0x06, 0x05, 0x03, 0x02, 0x00, 0x69,
+    0x20, 0x06, 0x01, 0x03, 0x04, 0x04, 0x03, 0x01, 0x00, 0x69,
+    0x20, 0x07, 0x01, 0x03, 0x03, 0x01, 0x00, 0x69,
+    0x20, 0x08, 0x01, 0x01, 0x00, 0x69,
+    0x20, 0x12, 0x69,
+    0x7f, 0x7f, 0x7f, 0x63,
+    0x7f, 0x7f, 0x7f, 0x63,
+    0x7f, 0x7f, 0x7f, 0x63,
+    0x7f, 0x7f, 0x7f, 0x63,
+    0x80
+};
+
+/*! \brief Clip from clips/twinkle.txt.
+ */
+const uint8_t twinkle_clip[] PROGMEM = {
+    0x20, 0x04, 0x11, 0x20, 0x0d, 0x73,
+    0x40, 0x11, 0x11, 0x40, 0x0e, 0x73,
+    0x40, 0x0e, 0x0e, 0x40, 0x0b, 0x73,
+    0x40, 0x11, 0x0b, 0x40, 0x08, 0x73,
+    0x41, 0x08, 0x40, 0x05, 0x73,
+    0x40, 0x0e, 0x05, 0x40, 0x02, 0x73,
+    0x40, 0x0b, 0x11, 0x20, 0x0a, 0x11, 0x73,
+    0x40, 0x08, 0x4a, 0x0e, 0x73,
+    0x40, 0x11, 0x0e, 0x11, 0x20, 0x09, 0x0b, 0x73,
+    0x41, 0x0b, 0x0e, 0x20, 0x09, 0x08, 0x73,
+    0x41, 0x08, 0x0b, 0x20, 0x03, 0x11, 0x20, 0x05, 0x05, 0x73,
+    0x40, 0x0e, 0x05, 0x08, 0x20, 0x03, 0x0e, 0x20, 0x05, 0x02, 0x73,
+    0x00, 0x0b, 0x02, 0x05, 0x20, 0x03, 0x0b, 0x00, 0x11, 0x20, 0x08, 0x73,
+    0x40, 0x08, 0x00, 0x02, 0x11, 0x41, 0x08, 0x40, 0x0e, 0x20, 0x07, 0x11, 0x73,
+    0x40, 0x05, 0x40, 0x00, 0x0e, 0x41, 0x05, 0x40, 0x0b, 0x20, 0x07, 0x0e, 0x73,
+    0x40, 0x02, 0x41, 0x0b, 0x41, 0x02, 0x40, 0x08, 0x20, 0x07, 0x11, 0x73,
+    0x20, 0x03, 0x11, 0x08, 0x20, 0x04, 0x05, 0x20, 0x07, 0x0e, 0x73,
+    0x20, 0x03, 0x0e, 0x05, 0x20, 0x04, 0x02, 0x00, 0x11, 0x20, 0x05, 0x0b, 0x73,
+    0x20, 0x03, 0x0b, 0x02, 0x20, 0x06, 0x0e, 0x20, 0x05, 0x08, 0x73,
+    0x20, 0x03, 0x08, 0x20, 0x07, 0x0b, 0x20, 0x05, 0x05, 0x73,
+    0x20, 0x03, 0x05, 0x20, 0x07, 0x08, 0x20, 0x05, 0x02, 0x73,
+    0x20, 0x03, 0x02, 0x20, 0x07, 0x05, 0x20, 0x03, 0x11, 0x00, 0x00, 0x73,
+    0x20, 0x0a, 0x11, 0x02, 0x41, 0x11, 0x0e, 0x73,
+    0x20, 0x09, 0x11, 0x0e, 0x11, 0x41, 0x0e, 0x0b, 0x73,
+    0x20, 0x05, 0x11, 0x20, 0x03, 0x0e, 0x0b, 0x0e, 0x41, 0x0b, 0x08, 0x73,
+    0x41, 0x11, 0x41, 0x0e, 0x20, 0x03, 0x0b, 0x08, 0x0b, 0x41, 0x08, 0x05, 0x73,
+    0x41, 0x0e, 0x41, 0x0b, 0x20, 0x03, 0x08, 0x05, 0x08, 0x41, 0x05, 0x02, 0x73,
+    0x41, 0x0b, 0x41, 0x08, 0x20, 0x03, 0x05, 0x02, 0x05, 0x41, 0x02, 0x00, 0x73,
+    0x41, 0x08, 0x41, 0x05, 0x20, 0x03, 0x02, 0x00, 0x02, 0x20, 0x03, 0x73,
+    0x41, 0x05, 0x41, 0x02, 0x20, 0x06, 0x73,
+    0x41, 0x02, 0x20, 0x03, 0x73,
+    0x20, 0x12, 0x73,
+    0x80
+};
@@ -0,0 +1,11 @@
+/* Generated by clip_encode, do not edit. See "make clips". */
+
+#ifndef CLIP_DATA_H
+#define CLIP_DATA_H
+
+#include <stdint.h>
+
+extern const uint8_t heartbeat_clip[];
+extern const uint8_t twinkle_clip[];
+
+#endif
@@ -0,0 +1,239 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "clip.h"
+
+/*! \addtogroup clip
+ *  @{
+ */
+
+/*! \file clip_encode.c
+ *  \brief Host program that turns frames into clips.
+ *
+ *  Usage: clip_encode [-h] [-n leds] file...
+ *
+ *  - -h: Write the declarations of the clips (for clip_data.h)
+ *        instead of their definitions (for clip_data.c).
+ *  - -n: The number of LEDs in a frame (default 18).
+ *
+ *  Each file holds the frames of one clip, one per line: the number
+ *  of frames of the \ref frame_clock to show it for, and then the
+ *  intensity of each LED from left to right. Lines starting with #
+ *  are comments. The clip is named after the file, so clips/foo.txt
+ *  becomes foo_clip.
+ *
+ *  The size of each clip is reported on stderr.
+ */
+
+/*! \brief File internal limits on the number of LEDs and on the
+ *         length of a frame in bytes, CLIP_SHOW tokens included.
+ */
+#define MAX_LEDS 255
+#define MAX_FRAME_BYTES (2 * MAX_LEDS + 255 / CLIP_MAX_ARG + 1)
+
+/*! \brief File internal function that encodes a frame.
+ *
+ *  Runs of three or more equal intensities become a CLIP_RUN, and
+ *  other intensities a CLIP_SET each. With a previous frame, runs of
+ *  unchanged LEDs between them become a CLIP_SKIP, and unchanged LEDs
+ *  at the end are left out.
+ *
+ *  \param out The tokens, without the CLIP_SHOW.
+ *  \param frame The intensities.
+ *  \param prev The previous frame, or 0 for a keyframe.
+ *  \param n The number of LEDs.
+ *  \return The number of bytes in out.
+ */
+static unsigned encode_frame(uint8_t *out, const uint8_t *frame,
+                             const uint8_t *prev, unsigned n)
+{
+    unsigned size, i, run, end;
+
+    end = n;
+    if (prev) {
+        while (end > 0 && frame[end - 1] == prev[end - 1]) {
+            end--;
+        }
+    }
+    size = 0;
+    i = 0;
+    while (i < end) {
+        for (run = 1; i + run < end && run < 255 &&
+             frame[i + run] == frame[i]; run++) {
+        }
+        if (run >= 3) {
+            out[size++] = CLIP_RUN | frame[i];
+            out[size++] = run;
+            i += run;
+        } else if (prev && frame[i] == prev[i]) {
+            for (run = 1; i + run < end && run < CLIP_MAX_ARG &&
+                 frame[i + run] == prev[i + run]; run++) {
+            }
+            out[size++] = CLIP_SKIP | (run - 1);
+            i += run;
+        } else {
+            out[size++] = CLIP_SET | frame[i];
+            i++;
+        }
+    }
+    return size;
+}
+
+/*! \brief File internal function that encodes the frames in a file
+ *         and writes the clip.
+ */
+static int encode_file(const char *path, const char *name, unsigned n,
+                       int header)
+{
+    FILE *f;
+    char line[4096];
+    char *p, *end;
+    uint8_t frame[MAX_LEDS], prev[MAX_LEDS];
+    uint8_t key[MAX_FRAME_BYTES], delta[MAX_FRAME_BYTES];
+    uint8_t *bytes;
+    unsigned long frames, keyframes, total, ticks, v;
+    unsigned size, i, k, line_no;
+
+    f = fopen(path, "r");
+    if (!f) {
+        perror(path);
+        return 1;
+    }
+    if (header) {
+        printf("extern const uint8_t %s_clip[];\n", name);
+    } else {
+        printf("\n/*! \\brief Clip from %s.\n */\n", path);
+        printf("const uint8_t %s_clip[] PROGMEM = {\n", name);
+    }
+    frames = 0;
+    keyframes = 0;
+    total = 0;
+    line_no = 0;
+    while (fgets(line, sizeof line, f)) {
+        line_no++;
+        p = line + strspn(line, " \t");
+        if (*p == '#' || *p == '\n' || *p == 0) {
+            continue;
+        }
+        ticks = strtoul(p, &end, 10);
+        for (i = 0; i < n; i++) {
+            p = end;
+            v = strtoul(p, &end, 10);
+            if (end == p || v > MAX_INTENSITY) {
+                fprintf(stderr, "%s:%u: expected %u intensities of at most "
+                        "%u\n", path, line_no, n, MAX_INTENSITY);
+                fclose(f);
+                return 1;
+            }
+            frame[i] = v;
+        }
+        if (ticks == 0 || ticks > 255) {
+            fprintf(stderr, "%s:%u: a frame must be shown for 1 to 255 "
+                    "frames\n", path, line_no);
+            fclose(f);
+            return 1;
+        }
+        // The first frame is looped back to, so it must be a keyframe
+        size = encode_frame(key, frame, 0, n);
+        bytes = key;
+        if (frames) {
+            k = encode_frame(delta, frame, prev, n);
+            if (k < size) {
+                size = k;
+                bytes = delta;
+            }
+        }
+        if (bytes == key) {
+            keyframes++;
+        }
+        memcpy(prev, frame, n);
+        for (; ticks > CLIP_MAX_ARG; ticks -= CLIP_MAX_ARG) {
+            bytes[size++] = CLIP_SHOW | (CLIP_MAX_ARG - 1);
+        }
+        bytes[size++] = CLIP_SHOW | (ticks - 1);
+        if (!header) {
+            printf("   ");
+            for (i = 0; i < size; i++) {
+                printf(" 0x%02x,", bytes[i]);
+            }
+            printf("\n");
+        }
+        frames++;
+        total += size;
+    }
+    fclose(f);
+    if (!frames) {
+        fprintf(stderr, "%s: no frames\n", path);
+        return 1;
+    }
+    total++;
+    if (!header) {
+        printf("    0x%02x\n};\n", CLIP_LOOP);
+        fprintf(stderr, "%s_clip: %lu frames, %lu keyframes, %lu bytes, "
+                "%.1f bytes per frame (raw %u)\n", name, frames, keyframes,
+                total, (double)total / frames, n);
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    char name[64];
+    const char *base;
+    size_t len;
+    unsigned n;
+    int header, opt, i;
+
+    n = 18;
+    header = 0;
+    while ((opt = getopt(argc, argv, "hn:")) != -1) {
+        switch (opt) {
+        case 'h':
+            header = 1;
+            break;
+        case 'n':
+            n = strtoul(optarg, 0, 10);
+            break;
+        default:
+            goto usage;
+        }
+    }
+    if (optind == argc || n == 0 || n > MAX_LEDS) {
+        goto usage;
+    }
+
+    printf("/* Generated by clip_encode, do not edit. See \"make clips\". "
+           "*/\n");
+    if (header) {
+        printf("\n#ifndef CLIP_DATA_H\n#define CLIP_DATA_H\n\n");
+        printf("#include <stdint.h>\n\n");
+    } else {
+        printf("\n#include \"hal.h\"\n\n#include \"clip_data.h\"\n");
+    }
+    for (i = optind; i < argc; i++) {
+        base = strrchr(argv[i], '/');
+        base = base ? base + 1 : argv[i];
+        len = strcspn(base, ".");
+        if (len >= sizeof name) {
+            len = sizeof name - 1;
+        }
+        memcpy(name, base, len);
+        name[len] = 0;
+        if (encode_file(argv[i], name, n, header)) {
+            return 1;
+        }
+    }
+    if (header) {
+        printf("\n#endif\n");
+    }
+    return 0;
+
+usage:
+    fprintf(stderr, "usage: %s [-h] [-n leds] file...\n", argv[0]);
+    return 1;
+}
+
+/*! @} */
@@ -75,6 +75,12 @@
 #define BUTTON_PORT D
 #define BUTTON_BIT  5
 
+/* With LED_SPI (see led.h), the pin that latches the shift register
+ * chain. The chain is clocked from the SPI pins MOSI (PB3) and SCK
+ * (PB5), and the LED pins above are not used. */
+#define LED_LATCH_PORT B
+#define LED_LATCH_BIT  2
+
 /*! @} */
 
 #endif
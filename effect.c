@@ -1,39 +1,47 @@
 #include <stdint.h>
+#include "hal.h"
 #include "led.h"
 #include "blink_kit.h"
+#include "power.h"
+#include "frame_clock.h"
+#include "wave.h"
+#include "script.h"
+#include "clip.h"
+#include "clip_data.h"
+#include "effect.h"
 
 /*! \addtogroup effect
  *  @{
  */
 
+/*! \brief Shortest time a step of #smooth_roll is shown, in frames.
+ */
+#define SMOOTH_ROLL_TICK FRAMES(2)
+
 /*! \brief Rotate a triangle shaped instensity distribution in
  *         increasing and decreasing speed.
+ *
+ *  Each step is shown for 1 to 18 times #SMOOTH_ROLL_TICK.
  */
-void smooth_roll(void)
+uint8_t smooth_roll(struct effect_state* s)
 {
-    int8_t i, j;
-
+    EFFECT_BEGIN(s);
     triangle();
     for (;;) {
-        for (i = 2; i < 20; i++) {
-            for (j = i; j < 20; j++) {
-                display_for(i);
+        for (s->i = 2; s->i < 20; s->i++) {
+            for (s->j = s->i; s->j < 20; s->j++) {
+                EFFECT_SHOW(s, (s->i - 1) * SMOOTH_ROLL_TICK);
                 rotate_right();
             }
-            if (should_exit()) {
-                return;
-            }
         }
-        for (i = 19; i > 2; i--) {
-            for (j = i; j < 20; j++) {
-                display_for(i);
+        for (s->i = 19; s->i > 2; s->i--) {
+            for (s->j = s->i; s->j < 20; s->j++) {
+                EFFECT_SHOW(s, (s->i - 1) * SMOOTH_ROLL_TICK);
                 rotate_right();
             }
-            if (should_exit()) {
-                return;
-            }
         }
     }
+    EFFECT_END(s);
 }
 
 /*! \brief Light all LEDs left to right and then darken them left to
@@ -43,57 +51,260 @@ void smooth_roll(void)
  *  until all leds are on. Then shift in unlit LEDs on the left until
  *  all leds are off again and repeat.
  */
-void fill_drain(void)
+uint8_t fill_drain(struct effect_state* s)
 {
-    uint8_t x;
-
+    EFFECT_BEGIN(s);
     clear(0);
     shift_right(MAX_INTENSITY);
-    while (!should_exit()) {
-        display_for(10);
-        x = MAX_INTENSITY - peek_right();
-        shift_right(x);
+    for (;;) {
+        EFFECT_SHOW(s, FRAMES(10));
+        shift_right(MAX_INTENSITY - peek_right());
     }
+    EFFECT_END(s);
 }
 
 
 /*! \brief Step the intensity of all LEDs simuntaneously up and down
  *         rapidly and repeatedly.
  */
-void flash(void)
+uint8_t flash(struct effect_state* s)
 {
-    int8_t i;
-
-    while(1) {
-        for (i = 0; i <= MAX_INTENSITY; i++) {
-            clear(i);
-            display_for(3);
-            if (should_exit()) {
-                return;
-            }
+    EFFECT_BEGIN(s);
+    for (;;) {
+        for (s->i = 0; s->i <= MAX_INTENSITY; s->i++) {
+            clear(s->i);
+            EFFECT_SHOW(s, FRAMES(2));
         }
-        for (i = MAX_INTENSITY; i >= 0; i--) {
-            clear(i);
-            display_for(3);
-            if (should_exit()) {
-                return;
-            }
+        for (s->i = MAX_INTENSITY; s->i >= 0; s->i--) {
+            clear(s->i);
+            EFFECT_SHOW(s, FRAMES(2));
         }
     }
+    EFFECT_END(s);
 }
 
-/*! \brief Register all available effects.
+/*! \brief File internal wave of #breathe.
+ */
+static struct wave breath;
+
+/*! \brief Fade all LEDs up and down together, like breathing.
  *
- *  To make the blink kit aware of a new effect, modify this function
- *  and add a call to #add_effect with the effect function as the only
- *  argument.
+ *  A breath lasts about four seconds, and starts and ends dark.
  */
-void effect_init(void)
+uint8_t breathe(struct effect_state* s)
 {
-    add_effect(smooth_roll);
-    add_effect(fill_drain);
-    add_effect(flash);
+    EFFECT_BEGIN(s);
+    breath = (struct wave){ 0xc000, 328, 0, WAVE_EXP };
+    for (;;) {
+        wave_render(&breath, 1);
+        EFFECT_SHOW(s, FRAMES(20));
+        wave_step(&breath, 1);
+    }
+    EFFECT_END(s);
 }
 
+/*! \brief File internal waves of #plasma.
+ */
+static struct wave plasma_waves[2];
+
+/*! \brief Let two sine waves of different lengths travel in opposite
+ *         directions, and show their sum.
+ */
+uint8_t plasma(struct effect_state* s)
+{
+    EFFECT_BEGIN(s);
+    plasma_waves[0] = (struct wave){ 0, 300, 23, WAVE_SINE };
+    plasma_waves[1] = (struct wave){ 0x4000, -170, -9, WAVE_SINE };
+    for (;;) {
+        wave_render(plasma_waves, 2);
+        EFFECT_SHOW(s, FRAMES(20));
+        wave_step(plasma_waves, 2);
+    }
+    EFFECT_END(s);
+}
+
+/*! \brief File internal width of the comets of #comets.
+ */
+#define COMET_WIDTH 5
+
+/*! \brief File internal shape of a comet flying right, tail first.
+ */
+static const uint8_t comet_right[COMET_WIDTH] PROGMEM =
+    { 16, 40, 90, 170, 255 };
+
+/*! \brief File internal shape of a comet flying left, head first.
+ */
+static const uint8_t comet_left[COMET_WIDTH] PROGMEM =
+    { 255, 170, 90, 40, 16 };
+
+/*! \brief File internal sprites of #comets.
+ */
+static struct sprite comet_sprites[2];
+
+/*! \brief Let two comets fly in opposite directions at different
+ *         speeds, and glow brighter where they cross.
+ *
+ *  A comet that has flown off one end comes back in at the other.
+ */
+uint8_t comets(struct effect_state* s)
+{
+    EFFECT_BEGIN(s);
+    comet_sprites[0] = (struct sprite){
+        comet_right, COMET_WIDTH, SPRITE_ADD, -(COMET_WIDTH << 8), 0x30 };
+    comet_sprites[1] = (struct sprite){
+        comet_left, COMET_WIDTH, SPRITE_ADD, NUM_LEDS << 8, -0x44 };
+    for (;;) {
+        clear(0);
+        sprite_render(comet_sprites, 2);
+        EFFECT_SHOW(s, FRAMES(20));
+        sprite_step(comet_sprites, 2);
+        if ((int16_t)comet_sprites[0].pos >= NUM_LEDS << 8) {
+            comet_sprites[0].pos -= (NUM_LEDS + COMET_WIDTH) << 8;
+        }
+        if ((int16_t)comet_sprites[1].pos < -(COMET_WIDTH << 8)) {
+            comet_sprites[1].pos += (NUM_LEDS + COMET_WIDTH) << 8;
+        }
+    }
+    EFFECT_END(s);
+}
+
+/*! \brief File internal script of #chase.
+ */
+static const uint8_t chase_script[] PROGMEM = {
+    SCRIPT_CLEAR, 0,
+    SCRIPT_SHIFT_RIGHT, 2,
+    SCRIPT_SHIFT_RIGHT, 6,
+    SCRIPT_SHIFT_RIGHT, MAX_INTENSITY,
+    SCRIPT_FOREVER(
+        SCRIPT_SHOW, FRAMES(30),
+        SCRIPT_ROTATE_RIGHT)
+};
+
+/*! \brief Let a LED with a short tail chase around the LEDs.
+ */
+uint8_t chase(struct effect_state* s)
+{
+    return script_step(s, chase_script);
+}
+
+/*! \brief File internal script of #bounce.
+ */
+static const uint8_t bounce_script[] PROGMEM = {
+    SCRIPT_CLEAR, 0,
+    SCRIPT_SHIFT_RIGHT, MAX_INTENSITY,
+    SCRIPT_FOREVER(
+        SCRIPT_REPEAT_J(3,
+            SCRIPT_REPEAT_I(NUM_LEDS - 1,
+                SCRIPT_SHOW, FRAMES(24),
+                SCRIPT_SHIFT_RIGHT, 0),
+            SCRIPT_REPEAT_I(NUM_LEDS - 1,
+                SCRIPT_SHOW, FRAMES(24),
+                SCRIPT_SHIFT_LEFT, 0)),
+        SCRIPT_REPEAT_I(2,
+            SCRIPT_CLEAR, 0,
+            SCRIPT_SHOW, FRAMES(80),
+            SCRIPT_SHIFT_RIGHT, MAX_INTENSITY,
+            SCRIPT_SHOW, FRAMES(80)))
+};
+
+/*! \brief Bounce a LED from end to end three times, and then blink
+ *         it twice at the left end.
+ */
+uint8_t bounce(struct effect_state* s)
+{
+    return script_step(s, bounce_script);
+}
+
+/*! \brief Play the heartbeat clip: two beats from the middle out,
+ *         then a pause.
+ */
+uint8_t heartbeat(struct effect_state* s)
+{
+    return clip_step(s, heartbeat_clip);
+}
+
+/*! \brief Play the twinkle clip: sparkles that light up at random and
+ *         fade out.
+ */
+uint8_t twinkle(struct effect_state* s)
+{
+    return clip_step(s, twinkle_clip);
+}
+
+#if LED_DITHER
+
+/*! \brief Fade all LEDs slowly up and down, using fractional levels.
+ */
+void slow_fade(void)
+{
+    int16_t level, next;
+    uint8_t i;
+    int8_t step;
+
+    level = 0;
+    step = 16;
+    while (!should_exit()) {
+        for (i = 0; i < NUM_LEDS; i++) {
+            set_level(i, level);
+        }
+        display_for(1);
+        // Signed, since with a 16 bit int an unsigned level would make
+        // the sum unsigned and it would never go below 0
+        next = level + step;
+        if (next > (int16_t)MAX_LEVEL || next < 0) {
+            step = -step;
+            next = level + step;
+        }
+        level = next;
+    }
+}
+
+#endif
+
+/*! \brief Turn the board off until the button is pressed.
+ *
+ *  The MCU sleeps in power-down mode, drawing almost no current.
+ */
+void standby(void)
+{
+    power_down();
+    should_exit();
+}
+
+/*! \brief All available effects, in flash.
+ *
+ *  The button cycles through the effects in this order. To make the
+ *  blink kit aware of a new effect, add a line with #EFFECT or
+ *  #STEP_EFFECT and the effect function as the only argument.
+ */
+const struct effect_entry effect_table[] PROGMEM = {
+    STEP_EFFECT(smooth_roll),
+    STEP_EFFECT(fill_drain),
+    STEP_EFFECT(flash),
+    STEP_EFFECT(breathe),
+    STEP_EFFECT(plasma),
+    STEP_EFFECT(comets),
+    STEP_EFFECT(chase),
+    STEP_EFFECT(bounce),
+    STEP_EFFECT(heartbeat),
+    STEP_EFFECT(twinkle),
+#if LED_DITHER
+    EFFECT(slow_fade),
+#endif
+    EFFECT(standby),
+};
+
+/*! \brief The number of entries in #effect_table, in flash.
+ */
+const uint8_t effect_table_size PROGMEM =
+    sizeof(effect_table) / sizeof(effect_table[0]);
+
+/*! \brief The number of late frames of each effect in #effect_table,
+ *         kept by the blink kit (see #get_effect_overruns).
+ *
+ *  Sized here, with the table, so that it grows with it.
+ */
+uint8_t effect_overruns[sizeof(effect_table) / sizeof(effect_table[0])];
+
 /*! @} */
 
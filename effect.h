@@ -1,27 +1,46 @@
 #ifndef EFFECT_H
 #define EFFECT_H
 
+#include <stdint.h>
+#include "blink_kit.h"
+
 /*! \defgroup effect Effects
  *  \brief Blink pattern definitions
  *
  *  A blink effect is represented as a function. The function should
  *  not take any arguments and should have return type void. In order
- *  to make the main program aware of an effect, a call to #add_effect
- *  for that effect must be added to the body of #effect_init.
+ *  to make the main program aware of an effect, an entry for that
+ *  effect must be added to #effect_table.
  *
  *  When an effect function returns, the next effect function in
  *  sequence will be called. An effect may run for as long time as it
- *  likes as long it follows one rule: it must call #should_exit every
- *  now and then and if #should_exit returns true the effect must
- *  return.
+ *  likes. When the button is pressed, the effect is aborted in its
+ *  next call to #display_for (see #abort_if_pressed), so it does not
+ *  have to check for it. An effect that has to tidy up before the
+ *  next effect runs can instead call #should_exit between frames and
+ *  return when it returns true.
+ *
+ *  An effect can also be a step function (see #step_function),
+ *  entered with #STEP_EFFECT. The blink kit calls it once per
+ *  step and shows the led array for as many frames as it returns.
+ *  Written with #EFFECT_BEGIN, #EFFECT_SHOW and #EFFECT_END, such an
+ *  effect reads like a blocking one, but keeps its loop counters in a
+ *  small #effect_state instead of on the stack, and leaves the frame
+ *  pacing to the blink kit.
  *
  *  A new effect can be created by writing a new function in \ref
- *  effect.c and adding a corresponding line in the body of the
- *  #effect_init function. See the source of \ref effect.c for example
- *  effects.
+ *  effect.c and adding a corresponding line to #effect_table. The
+ *  table is built by the compiler and kept in flash, so the effects
+ *  take no RAM and need no registering at startup, and their number
+ *  is only bounded by the flash. See the source of \ref effect.c for
+ *  example effects.
  */
 
-void effect_init(void);
+extern const struct effect_entry effect_table[];
+
+extern const uint8_t effect_table_size;
+
+extern uint8_t effect_overruns[];
 
 #endif
 
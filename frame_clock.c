@@ -0,0 +1,54 @@
+
+#include "hal.h"
+#include "frame_clock.h"
+#include "trace.h"
+
+/*! \addtogroup frame_clock
+ *  @{
+ */
+
+/*! \brief File internal clock select bits for timer 1 (clk/8).
+ */
+#define TIMER1_PRESCALER (1<<CS11)
+
+#ifndef F_CPU
+#error "F_CPU must be set to the CPU clock in Hz"
+#endif
+
+/*! \brief File internal compare value of timer 1.
+ */
+#define TIMER1_TOP (F_CPU / 8 / FRAME_RATE - 1)
+
+#if TIMER1_TOP > 0xffff
+#error "FRAME_RATE is too low for timer 1 at this F_CPU"
+#endif
+
+/*! \brief Number of frames since #frame_clock_init.
+ *
+ *  Incremented by the timer 1 interrupt. It wraps around, so compare
+ *  it with differences.
+ */
+volatile uint8_t clock_frame;
+
+/*! \brief Start timer 1 in CTC mode with one compare match per frame.
+ */
+void frame_clock_init(void)
+{
+    clock_frame = 0;
+    OCR1A = TIMER1_TOP;
+    TCCR1A = 0;
+    TCCR1B = (1<<WGM12) | TIMER1_PRESCALER;
+    TIMSK1 = 1<<OCIE1A;
+}
+
+/*! \brief Timer 1 compare match A interrupt service routine.
+ *
+ *  Counts the frames.
+ */
+ISR(TIMER1_COMPA_vect)
+{
+    TRACE_ISR();
+    clock_frame++;
+}
+
+/*! @} */
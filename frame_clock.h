@@ -0,0 +1,55 @@
+#ifndef FRAME_CLOCK_H
+#define FRAME_CLOCK_H
+
+#include <stdint.h>
+#include "led.h"
+
+/*! \defgroup frame_clock Frame clock
+ *  \brief Fixed rate time base for the effects
+ *
+ *  Timer 1 ticks at #FRAME_RATE frames per second, independently of
+ *  the PWM engine. #display_for waits on this clock, so effects run
+ *  at the same speed whatever the PWM engine or F_CPU.
+ *
+ *  The #frame_clock_init function has to be called for the clock to
+ *  run.
+ */
+
+/*! \addtogroup frame_clock
+ *  @{
+ */
+
+/*! \brief The number of frames per second.
+ *
+ *  A frame must be longer than the longest PWM frame, or frames are
+ *  counted as overruns by #display_for. The LED module checks this at
+ *  compile time. A PWM frame on the I/O pins takes about 1.5 ms at 8
+ *  MHz, and one of #LED_SPI about 8.2 ms (33 ms for chains of over 64
+ *  LEDs), so the default rate depends on the engine. Can be set from
+ *  the Makefile with -DFRAME_RATE=n.
+ */
+#ifndef FRAME_RATE
+#if !LED_SPI
+#define FRAME_RATE 500
+#elif NUM_LEDS <= 64
+#define FRAME_RATE 100
+#else
+#define FRAME_RATE 25
+#endif
+#endif
+
+/*! \brief The number of frames that last at least a time in
+ *         milliseconds.
+ *
+ *  Rounds up, so that a time above 0 is never 0 frames. Meant for
+ *  constants, since it divides.
+ */
+#define FRAMES(ms) (((ms) * 1UL * FRAME_RATE + 999) / 1000)
+
+extern volatile uint8_t clock_frame;
+
+void frame_clock_init(void);
+
+/*! @} */
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef HAL_H
+#define HAL_H
+
+/*! \defgroup hal HAL
+ *  \brief Thin hardware abstraction layer
+ *
+ *  The \ref led and \ref button modules include this header instead
+ *  of the avr-libc headers. When building for the AVR it is nothing
+ *  more than those headers, so the generated code is unchanged. When
+ *  building natively (with -DNATIVE, see the "native" Makefile
+ *  target) the same names are provided by hal_native.h, which
+ *  simulates the I/O ports, the timers and the button on the host.
+ *
+ *  Code that waits for an interrupt to happen must call #hal_idle in
+ *  its wait loop, since that is where the native backend lets
+ *  simulated time pass. On the AVR it sleeps until the next
+ *  interrupt, in the sleep mode selected with set_sleep_mode. The LED
+ *  module calls #hal_frame when a new frame starts being shown and
+ *  #hal_latch when it latches the shift register chain, and the \ref
+ *  trace module calls #hal_trace for each event, so that the native
+ *  backend can record them.
+ */
+
+/*! \addtogroup hal
+ *  @{
+ */
+
+#ifdef NATIVE
+
+#include "hal_native.h"
+
+#else
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <avr/sleep.h>
+#include <util/atomic.h>
+
+/*! \brief Called from loops that wait for an interrupt.
+ */
+#define hal_idle() sleep_mode()
+
+/*! \brief Called when a new frame starts being shown.
+ */
+#define hal_frame(frame, head) do { } while (0)
+
+/*! \brief Called when the shift register chain has been latched.
+ */
+#define hal_latch() do { } while (0)
+
+/*! \brief Called when a trace event has been written.
+ */
+#define hal_trace(event, size) do { } while (0)
+
+#endif
+
+/*! @} */
+
+#endif
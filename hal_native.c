@@ -0,0 +1,615 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "hal.h"
+#include "config.h"
+#include "led.h"
+
+/*! \addtogroup hal
+ *  @{
+ */
+
+/*! \file hal_native.c
+ *  \brief Simulation of the AVR peripherals used by the firmware.
+ *
+ *  Time only passes in #hal_idle and when TCNT0 is read, which is
+ *  where the firmware waits. Interrupts are likewise only taken in
+ *  #hal_idle, so the code between two calls runs atomically and in
+ *  zero simulated time.
+ */
+
+#define PORT_(p) PORT##p
+#define PORT(p) PORT_(p)
+#define DDR_(p) DDR##p
+#define DDR(p) DDR_(p)
+#define PIN_(p) PIN##p
+#define PIN(p) PIN_(p)
+#define PCMSK_(p) PORT##p##_PCMSK
+#define PCMSK(p) PCMSK_(p)
+#define PCIE_(p) PORT##p##_PCIE
+#define PCIE(p) PCIE_(p)
+#define PCINT_vect_(p) PORT##p##_PCINT_vect
+#define PCINT_vect(p) PCINT_vect_(p)
+
+#define PORTA_PCIE PCIE3
+#define PORTB_PCIE PCIE0
+#define PORTC_PCIE PCIE1
+#define PORTD_PCIE PCIE2
+
+#define PORTA_PCMSK PCMSK3
+#define PORTB_PCMSK PCMSK0
+#define PORTC_PCMSK PCMSK1
+#define PORTD_PCMSK PCMSK2
+
+#define PORTA_PCINT_vect PCINT3_vect
+#define PORTB_PCINT_vect PCINT0_vect
+#define PORTC_PCINT_vect PCINT1_vect
+#define PORTD_PCINT_vect PCINT2_vect
+
+/*! \brief File internal number of cycles one read of TCNT0 takes.
+ *
+ *  Lets busy waits on TCNT0 make progress.
+ */
+#define TCNT0_READ_CYCLES 4
+
+/*! \brief File internal time the simulated button is held down.
+ */
+#define BUTTON_HOLD_CYCLES (F_CPU / 20)
+
+/*! \brief File internal limit on the number of scheduled presses.
+ */
+#define MAX_PRESSES 64
+
+/*! \brief File internal supply currents in nA, for #hal_charge.
+ *
+ *  Rough typical values for an ATtiny48 at 8 MHz and 5 V, and a LED
+ *  current that depends on the series resistors. Each can be set
+ *  with -D to match the board.
+ */
+#ifndef ACTIVE_NA
+#define ACTIVE_NA 3800000
+#endif
+#ifndef IDLE_NA
+#define IDLE_NA 1000000
+#endif
+#ifndef POWER_DOWN_NA
+#define POWER_DOWN_NA 100
+#endif
+#ifndef LED_NA
+#define LED_NA 10000000
+#endif
+#ifndef TWI_NA
+#define TWI_NA 100000
+#endif
+#ifndef TIMER0_NA
+#define TIMER0_NA 30000
+#endif
+#ifndef TIMER1_NA
+#define TIMER1_NA 60000
+#endif
+#ifndef SPI_NA
+#define SPI_NA 100000
+#endif
+#ifndef ADC_NA
+#define ADC_NA 150000
+#endif
+
+volatile uint8_t PORTA, PORTB, PORTC, PORTD;
+volatile uint8_t DDRA, DDRB, DDRC, DDRD;
+volatile uint8_t PINA = 0xff, PINB = 0xff, PINC = 0xff, PIND = 0xff;
+volatile uint8_t PCICR, PCMSK0, PCMSK1, PCMSK2, PCMSK3;
+volatile uint8_t TCCR0A, OCR0A, OCR0B, TIMSK0;
+volatile uint8_t TCCR1A, TCCR1B, TIMSK1;
+volatile uint16_t OCR1A;
+volatile uint8_t PRR, SMCR;
+volatile uint8_t SPCR;
+
+uint64_t hal_cycles;
+uint64_t hal_charge;
+uint64_t hal_end_cycle;
+void (*hal_led_hook)(uint64_t cycle, uint8_t led, uint8_t on);
+void (*hal_frame_hook)(const uint8_t *frame, uint8_t head);
+void (*hal_power_down_hook)(void);
+void (*hal_trace_hook)(const void *event, uint8_t size);
+
+/* Only the vectors used by the build are defined */
+void TIMER1_COMPA_vect(void) __attribute__((weak));
+void TIMER0_COMPA_vect(void) __attribute__((weak));
+void TIMER0_COMPB_vect(void) __attribute__((weak));
+void PCINT_vect(BUTTON_PORT)(void) __attribute__((weak));
+
+/*! \brief File internal state of the simulated timer 0.
+ */
+static volatile uint8_t tcnt0;
+static uint64_t timer_cycle;
+static uint8_t pending_a, pending_b;
+
+/*! \brief File internal state of the simulated timer 1.
+ */
+static volatile uint16_t tcnt1;
+static uint64_t timer1_cycle;
+static uint8_t pending_1a;
+
+/*! \brief File internal interrupt enable flag (the I bit of SREG).
+ */
+static uint8_t interrupts_enabled;
+
+/*! \brief File internal state of the simulated button.
+ */
+static uint64_t presses[MAX_PRESSES];
+static uint8_t press_count, press_next;
+static uint64_t release_cycle;
+static uint8_t pending_pcint;
+
+/*! \brief File internal state of the simulated SPI.
+ *
+ *  A byte written to SPDR is pending until SPSR is read, which is
+ *  where the firmware waits for it to be shifted out.
+ */
+static volatile uint8_t spdr, spsr;
+static uint8_t spi_pending;
+
+/*! \brief File internal state of the simulated shift register chain:
+ *         the shift registers, and the latched outputs.
+ *
+ *  Byte k is the kth register from the AVR.
+ */
+static uint8_t chain_shift[LED_SPI_BYTES];
+static uint8_t chain_out[LED_SPI_BYTES];
+
+#if !LED_SPI
+
+/*! \brief File internal pin map, and the LED states last reported.
+ */
+#define LED_PIN(n) { &PORT(LED##n##_PORT), &DDR(LED##n##_PORT), \
+                     1<<LED##n##_BIT }
+static const struct {
+    volatile uint8_t *port;
+    volatile uint8_t *ddr;
+    uint8_t mask;
+} led_pins[NUM_LEDS] = {
+    LED_PIN(0), LED_PIN(1), LED_PIN(2), LED_PIN(3), LED_PIN(4),
+    LED_PIN(5), LED_PIN(6), LED_PIN(7), LED_PIN(8), LED_PIN(9),
+    LED_PIN(10), LED_PIN(11), LED_PIN(12), LED_PIN(13), LED_PIN(14),
+    LED_PIN(15), LED_PIN(16), LED_PIN(17)
+};
+
+#endif
+
+static uint8_t led_state[NUM_LEDS];
+static uint8_t leds_lit;
+
+/*! \brief File internal function that reports changed LEDs to
+ *         #hal_led_hook.
+ */
+static void check_leds(void)
+{
+    uint8_t i;
+    uint8_t on;
+
+    for (i = 0; i < NUM_LEDS; i++) {
+#if LED_SPI
+        on = (chain_out[i >> 3] >> (i & 7)) & 1;
+#else
+        on = (*led_pins[i].port & *led_pins[i].ddr & led_pins[i].mask) != 0;
+#endif
+        if (on != led_state[i]) {
+            led_state[i] = on;
+            leds_lit += on ? 1 : -1;
+            if (hal_led_hook) {
+                hal_led_hook(hal_cycles, i, on);
+            }
+        }
+    }
+}
+
+/*! \brief File internal number of CPU cycles per timer 0 count, or 0
+ *         if the timer is stopped.
+ */
+static uint32_t prescale(void)
+{
+    switch (TCCR0A & ((1<<CS02) | (1<<CS01) | (1<<CS00))) {
+    case 1: return 1;
+    case 2: return 8;
+    case 3: return 64;
+    case 4: return 256;
+    case 5: return 1024;
+    default: return 0;
+    }
+}
+
+/*! \brief File internal function that brings timer 0 up to date with
+ *         the simulated time.
+ *
+ *  In CTC mode the counter is cleared on the count after it has
+ *  matched OCR0A. Compare matches set pending flags.
+ */
+static void sync_timer(void)
+{
+    uint32_t p;
+
+    p = prescale();
+    if (p == 0) {
+        timer_cycle = hal_cycles;
+        return;
+    }
+    while (hal_cycles - timer_cycle >= p) {
+        timer_cycle += p;
+        if ((TCCR0A & (1<<CTC0)) && tcnt0 == OCR0A) {
+            tcnt0 = 0;
+        } else {
+            tcnt0++;
+        }
+        if (tcnt0 == OCR0A) {
+            pending_a = 1;
+        }
+        if (tcnt0 == OCR0B) {
+            pending_b = 1;
+        }
+    }
+}
+
+/*! \brief File internal number of CPU cycles per timer 1 count, or 0
+ *         if the timer is stopped.
+ */
+static uint32_t prescale1(void)
+{
+    if (PRR & (1<<PRTIM1)) {
+        return 0;
+    }
+    switch (TCCR1B & ((1<<CS12) | (1<<CS11) | (1<<CS10))) {
+    case 1: return 1;
+    case 2: return 8;
+    case 3: return 64;
+    case 4: return 256;
+    case 5: return 1024;
+    default: return 0;
+    }
+}
+
+/*! \brief File internal function that brings timer 1 up to date with
+ *         the simulated time.
+ *
+ *  Only CTC mode on OCR1A is simulated: the counter is cleared on the
+ *  count after it has matched OCR1A, and the match sets a pending
+ *  flag.
+ */
+static void sync_timer1(void)
+{
+    uint32_t p;
+    uint64_t counts;
+    uint32_t left;
+
+    p = prescale1();
+    if (p == 0) {
+        timer1_cycle = hal_cycles;
+        return;
+    }
+    counts = (hal_cycles - timer1_cycle) / p;
+    timer1_cycle += counts * p;
+    while (counts) {
+        // Counts until the next match
+        left = tcnt1 < OCR1A ? OCR1A - tcnt1 : OCR1A + 1;
+        if (counts < left) {
+            tcnt1 = tcnt1 < OCR1A ? tcnt1 + counts : counts - 1;
+            return;
+        }
+        counts -= left;
+        tcnt1 = OCR1A;
+        pending_1a = 1;
+    }
+}
+
+/*! \brief File internal function that updates the button pin.
+ */
+static void sync_button(void)
+{
+    if (press_next < press_count && hal_cycles >= presses[press_next]) {
+        press_next++;
+        PIN(BUTTON_PORT) &= ~(1<<BUTTON_BIT);
+        release_cycle = hal_cycles + BUTTON_HOLD_CYCLES;
+        pending_pcint = 1;
+    } else if (release_cycle && hal_cycles >= release_cycle) {
+        release_cycle = 0;
+        PIN(BUTTON_PORT) |= 1<<BUTTON_BIT;
+        pending_pcint = 1;
+    }
+}
+
+/*! \brief File internal function that runs an interrupt service
+ *         routine with interrupts disabled.
+ */
+static void run_isr(void (*isr)(void))
+{
+    interrupts_enabled = 0;
+    isr();
+    interrupts_enabled = 1;
+    check_leds();
+}
+
+/*! \brief File internal function that takes the highest priority
+ *         pending interrupt.
+ *
+ *  \return 1 if an interrupt was taken.
+ */
+static uint8_t take_interrupt(void)
+{
+    if (!interrupts_enabled) {
+        return 0;
+    }
+    if (pending_pcint) {
+        pending_pcint = 0;
+        if ((PCICR & (1<<PCIE(BUTTON_PORT))) &&
+            (PCMSK(BUTTON_PORT) & (1<<BUTTON_BIT)) &&
+            PCINT_vect(BUTTON_PORT)) {
+            run_isr(PCINT_vect(BUTTON_PORT));
+            return 1;
+        }
+    }
+    if (pending_1a) {
+        pending_1a = 0;
+        if ((TIMSK1 & (1<<OCIE1A)) && TIMER1_COMPA_vect) {
+            run_isr(TIMER1_COMPA_vect);
+            return 1;
+        }
+    }
+    if (pending_a) {
+        pending_a = 0;
+        if ((TIMSK0 & (1<<OCIE0A)) && TIMER0_COMPA_vect) {
+            run_isr(TIMER0_COMPA_vect);
+            return 1;
+        }
+    }
+    if (pending_b) {
+        pending_b = 0;
+        if ((TIMSK0 & (1<<OCIE0B)) && TIMER0_COMPB_vect) {
+            run_isr(TIMER0_COMPB_vect);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*! \brief File internal current of the peripherals that are not
+ *         turned off in PRR, in nA.
+ */
+static uint32_t peripheral_current(void)
+{
+    uint32_t na;
+
+    na = 0;
+    if (!(PRR & (1<<PRTWI))) {
+        na += TWI_NA;
+    }
+    if (!(PRR & (1<<PRTIM0))) {
+        na += TIMER0_NA;
+    }
+    if (!(PRR & (1<<PRTIM1))) {
+        na += TIMER1_NA;
+    }
+    if (!(PRR & (1<<PRSPI))) {
+        na += SPI_NA;
+    }
+    if (!(PRR & (1<<PRADC))) {
+        na += ADC_NA;
+    }
+    return na;
+}
+
+/*! \brief File internal function that advances the simulated time.
+ *
+ *  \param cycles The number of cycles.
+ *  \param mcu_na The current of the MCU core meanwhile, in nA.
+ */
+static void advance(uint64_t cycles, uint32_t mcu_na)
+{
+    hal_charge += cycles * (mcu_na + (uint64_t)leds_lit * LED_NA);
+    hal_cycles += cycles;
+    if (hal_end_cycle && hal_cycles >= hal_end_cycle) {
+        exit(0);
+    }
+    sync_timer();
+    sync_timer1();
+    sync_button();
+}
+
+/*! \brief Enable interrupts.
+ */
+void hal_sei(void)
+{
+    interrupts_enabled = 1;
+}
+
+/*! \brief Disable interrupts.
+ */
+void hal_cli(void)
+{
+    interrupts_enabled = 0;
+}
+
+/*! \brief Read or write timer 0.
+ *
+ *  Each read takes #TCNT0_READ_CYCLES of simulated time.
+ */
+volatile uint8_t *hal_tcnt0(void)
+{
+    check_leds();
+    advance(TCNT0_READ_CYCLES, ACTIVE_NA + peripheral_current());
+    return &tcnt0;
+}
+
+/*! \brief Read or write timer 1.
+ *
+ *  Unlike TCNT0, reading it takes no simulated time.
+ */
+volatile uint16_t *hal_tcnt1(void)
+{
+    sync_timer1();
+    return &tcnt1;
+}
+
+/*! \brief File internal number of CPU cycles the SPI takes to
+ *         shift out a byte.
+ */
+static uint32_t spi_byte_cycles(void)
+{
+    uint32_t divider;
+
+    divider = 4 << (2 * (SPCR & ((1<<SPR1) | (1<<SPR0))));
+    if ((SPCR & ((1<<SPR1) | (1<<SPR0))) == ((1<<SPR1) | (1<<SPR0))) {
+        divider = 128;
+    }
+    if (spsr & (1<<SPI2X)) {
+        divider /= 2;
+    }
+    return 8 * divider;
+}
+
+/*! \brief Write the SPI data register.
+ *
+ *  Starts shifting out a byte. A byte that is still pending is
+ *  shifted out first.
+ */
+volatile uint8_t *hal_spdr(void)
+{
+    if (spi_pending) {
+        hal_spsr();
+    }
+    spi_pending = 1;
+    spsr &= ~(1<<SPIF);
+    return &spdr;
+}
+
+/*! \brief Read or write the SPI status register.
+ *
+ *  Shifts the pending byte into the chain, which takes the time of
+ *  eight SPI clocks. Exits the program if the SPI is not enabled in
+ *  master mode, since the firmware would then wait forever.
+ */
+volatile uint8_t *hal_spsr(void)
+{
+    uint8_t k;
+
+    if (spi_pending) {
+        if ((SPCR & ((1<<SPE) | (1<<MSTR))) != ((1<<SPE) | (1<<MSTR)) ||
+            (PRR & (1<<PRSPI))) {
+            fprintf(stderr, "hal_native: SPI used while not enabled\n");
+            exit(1);
+        }
+        spi_pending = 0;
+        for (k = LED_SPI_BYTES - 1; k > 0; k--) {
+            chain_shift[k] = chain_shift[k - 1];
+        }
+        chain_shift[0] = spdr;
+        advance(spi_byte_cycles(), ACTIVE_NA + peripheral_current());
+        spsr |= 1<<SPIF;
+    }
+    return &spsr;
+}
+
+/*! \brief Latch the shift register chain to its outputs.
+ */
+void hal_latch(void)
+{
+    uint8_t k;
+
+    for (k = 0; k < LED_SPI_BYTES; k++) {
+        chain_out[k] = chain_shift[k];
+    }
+    check_leds();
+}
+
+/*! \brief File internal function that gets the time of the next
+ *         button pin change.
+ *
+ *  Exits the program if there is none, since nothing else can wake
+ *  the MCU when the timers are stopped.
+ */
+static uint64_t next_button_change(void)
+{
+    uint64_t next;
+
+    if (press_next < press_count) {
+        next = presses[press_next];
+        if (release_cycle && release_cycle < next) {
+            next = release_cycle;
+        }
+    } else if (release_cycle) {
+        next = release_cycle;
+    } else if (hal_end_cycle) {
+        next = hal_end_cycle;
+    } else {
+        exit(0);
+    }
+    return next > hal_cycles ? next : hal_cycles + 1;
+}
+
+/*! \brief Sleep until an interrupt has been taken.
+ *
+ *  In idle mode the timers keep running. In power-down mode all clocks
+ *  are stopped, so only a button press can wake the MCU, and time
+ *  skips ahead to it.
+ */
+void hal_idle(void)
+{
+    uint32_t p;
+
+    check_leds();
+    if ((SMCR & ((1<<SM1) | (1<<SM0))) == SLEEP_MODE_PWR_DOWN) {
+        if (hal_power_down_hook) {
+            hal_power_down_hook();
+        }
+        while (!take_interrupt()) {
+            advance(next_button_change() - hal_cycles, POWER_DOWN_NA);
+        }
+        return;
+    }
+    while (!take_interrupt()) {
+        p = prescale();
+        if (!p) {
+            p = prescale1();
+        }
+        if (p) {
+            advance(p, IDLE_NA + peripheral_current());
+        } else {
+            advance(next_button_change() - hal_cycles,
+                    IDLE_NA + peripheral_current());
+        }
+    }
+}
+
+/*! \brief Report a frame that starts being shown to #hal_frame_hook.
+ */
+void hal_frame(const uint8_t *frame, uint8_t head)
+{
+    check_leds();
+    if (hal_frame_hook) {
+        hal_frame_hook(frame, head);
+    }
+}
+
+/*! \brief Report a trace event to #hal_trace_hook.
+ */
+void hal_trace(const void *event, uint8_t size)
+{
+    if (hal_trace_hook) {
+        hal_trace_hook(event, size);
+    }
+}
+
+/*! \brief Schedule a button press.
+ *
+ *  Presses must be scheduled in increasing order of time.
+ *
+ *  \param cycle The simulated time of the press.
+ */
+void hal_press_button(uint64_t cycle)
+{
+    if (press_count != MAX_PRESSES) {
+        presses[press_count] = cycle;
+        press_count++;
+    }
+}
+
+/*! @} */
@@ -0,0 +1,168 @@
+#ifndef HAL_NATIVE_H
+#define HAL_NATIVE_H
+
+#include <stdint.h>
+
+/*! \addtogroup hal
+ *  @{
+ */
+
+/*! \file hal_native.h
+ *  \brief Native (host) backend of the \ref hal module.
+ *
+ *  The I/O registers used by the firmware are plain variables, except
+ *  TCNT0 and TCNT1 which follow the simulated time, and SPDR and SPSR
+ *  which shift bytes into a simulated chain of 74HC595 shift
+ *  registers (see #LED_SPI). Timer 1 is only simulated in CTC mode on
+ *  OCR1A. Interrupt service routines become ordinary functions that
+ *  hal_native.c calls when their simulated interrupt fires.
+ */
+
+/*! \brief Simulated CPU clock frequency in Hz.
+ */
+#ifndef F_CPU
+#define F_CPU 8000000UL
+#endif
+
+extern volatile uint8_t PORTA, PORTB, PORTC, PORTD;
+extern volatile uint8_t DDRA, DDRB, DDRC, DDRD;
+extern volatile uint8_t PINA, PINB, PINC, PIND;
+extern volatile uint8_t PCICR, PCMSK0, PCMSK1, PCMSK2, PCMSK3;
+extern volatile uint8_t TCCR0A, OCR0A, OCR0B, TIMSK0;
+extern volatile uint8_t TCCR1A, TCCR1B, TIMSK1;
+extern volatile uint16_t OCR1A;
+extern volatile uint8_t PRR, SMCR;
+extern volatile uint8_t SPCR;
+
+volatile uint8_t *hal_tcnt0(void);
+#define TCNT0 (*hal_tcnt0())
+volatile uint16_t *hal_tcnt1(void);
+#define TCNT1 (*hal_tcnt1())
+volatile uint8_t *hal_spdr(void);
+#define SPDR (*hal_spdr())
+volatile uint8_t *hal_spsr(void);
+#define SPSR (*hal_spsr())
+
+#define CS00 0
+#define CS01 1
+#define CS02 2
+#define CTC0 3
+
+#define TOIE0 0
+#define OCIE0A 1
+#define OCIE0B 2
+
+#define CS10 0
+#define CS11 1
+#define CS12 2
+#define WGM12 3
+
+#define OCIE1A 1
+
+#define SPR0 0
+#define SPR1 1
+#define MSTR 4
+#define SPE 6
+#define SPI2X 0
+#define SPIF 7
+
+#define PCIE0 0
+#define PCIE1 1
+#define PCIE2 2
+#define PCIE3 3
+
+#define PRADC 0
+#define PRSPI 2
+#define PRTIM1 3
+#define PRTIM0 5
+#define PRTWI 7
+
+#define SE 0
+#define SM0 1
+#define SM1 2
+#define SLEEP_MODE_IDLE 0
+#define SLEEP_MODE_PWR_DOWN (1<<SM1)
+
+#define set_sleep_mode(mode) \
+    (SMCR = (SMCR & ~((1<<SM1) | (1<<SM0))) | (mode))
+#define sleep_enable() (SMCR |= 1<<SE)
+#define sleep_disable() (SMCR &= ~(1<<SE))
+#define sleep_cpu() hal_idle()
+#define sleep_mode() hal_idle()
+
+#define ISR(vector) void vector(void)
+
+void hal_sei(void);
+void hal_cli(void);
+#define sei() hal_sei()
+#define cli() hal_cli()
+
+#define PROGMEM
+#define pgm_read_byte(addr) (*(const uint8_t *)(addr))
+#define pgm_read_word(addr) (*(const uint16_t *)(addr))
+#define pgm_read_ptr(addr) (*(void * const *)(addr))
+
+/* Interrupts only run from hal_idle, so every block is atomic */
+#define ATOMIC_RESTORESTATE
+#define ATOMIC_BLOCK(type) \
+    for (uint8_t hal_atomic_ = 1; hal_atomic_; hal_atomic_ = 0)
+
+void hal_idle(void);
+
+/*! \brief Simulated time in CPU cycles since start.
+ */
+extern uint64_t hal_cycles;
+
+/*! \brief Estimated charge drawn since start, in nA times CPU cycles.
+ *
+ *  Counts the MCU in its current sleep mode or active state, the
+ *  peripherals not turned off in PRR, and the lit LEDs. Code between
+ *  waits takes no simulated time, so the active current is only
+ *  counted while TCNT0 is busy waited on; use the simavr benchmark
+ *  for the cycles code takes.
+ */
+extern uint64_t hal_charge;
+
+/*! \brief Simulated time at which the program exits, or 0 to run
+ *         forever.
+ */
+extern uint64_t hal_end_cycle;
+
+/*! \brief Called on every LED transition, if set.
+ *
+ *  \param cycle The simulated time of the transition.
+ *  \param led The index of the LED.
+ *  \param on 1 if the LED was turned on, 0 if it was turned off.
+ */
+extern void (*hal_led_hook)(uint64_t cycle, uint8_t led, uint8_t on);
+
+/*! \brief Called with each frame when it starts being shown, if set.
+ *
+ *  The arguments are those of #led_show.
+ */
+extern void (*hal_frame_hook)(const uint8_t *frame, uint8_t head);
+
+void hal_frame(const uint8_t *frame, uint8_t head);
+
+/*! \brief Called with each trace event when it is written, if set.
+ *
+ *  The event is size bytes in the firmware's layout.
+ */
+extern void (*hal_trace_hook)(const void *event, uint8_t size);
+
+void hal_trace(const void *event, uint8_t size);
+
+void hal_latch(void);
+
+/*! \brief Called when the MCU enters power-down sleep, if set.
+ *
+ *  Lets a simulation that cannot wait for a scheduled press wake the
+ *  MCU up with #hal_press_button.
+ */
+extern void (*hal_power_down_hook)(void);
+
+void hal_press_button(uint64_t cycle);
+
+/*! @} */
+
+#endif
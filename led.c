@@ -1,110 +1,85 @@
-#include <avr/io.h>
+#include "hal.h"
 
 #include "config.h"
 #include "led.h"
 #include "blink_kit.h"
+#include "frame_clock.h"
+#include "trace.h"
 
 #define PORT_(p) PORT##p
 #define PORT(p) PORT_(p)
-#define PIN_(p) PIN##p
-#define PIN(p) PIN_(p)
 #define DDR_(p) DDR##p
 #define DDR(p) DDR_(p)
+#define PORT_ID_(p) PORT_ID_##p
+#define PORT_ID(p) PORT_ID_(p)
+
+#define PORT_ID_A 0
+#define PORT_ID_B 1
+#define PORT_ID_C 2
+#define PORT_ID_D 3
+#define NUM_PORTS 4
+
+#define LED_PORT_BIT(id, n) \
+    ((PORT_ID(LED##n##_PORT) == (id)) ? (1<<LED##n##_BIT) : 0)
+#define LED_PORT_MASK(id) \
+    (LED_PORT_BIT(id, 0) | LED_PORT_BIT(id, 1) | LED_PORT_BIT(id, 2) | \
+     LED_PORT_BIT(id, 3) | LED_PORT_BIT(id, 4) | LED_PORT_BIT(id, 5) | \
+     LED_PORT_BIT(id, 6) | LED_PORT_BIT(id, 7) | LED_PORT_BIT(id, 8) | \
+     LED_PORT_BIT(id, 9) | LED_PORT_BIT(id, 10) | LED_PORT_BIT(id, 11) | \
+     LED_PORT_BIT(id, 12) | LED_PORT_BIT(id, 13) | LED_PORT_BIT(id, 14) | \
+     LED_PORT_BIT(id, 15) | LED_PORT_BIT(id, 16) | LED_PORT_BIT(id, 17))
+
+/* Compile time masks of the LED bits on each port */
+#define LED_MASK_A LED_PORT_MASK(PORT_ID_A)
+#define LED_MASK_B LED_PORT_MASK(PORT_ID_B)
+#define LED_MASK_C LED_PORT_MASK(PORT_ID_C)
+#define LED_MASK_D LED_PORT_MASK(PORT_ID_D)
 
 /*! \addtogroup led
  *  @{
  */
 
-/*! \brief File internal lookup table from led index to PORT register
- *         address.
- *
- *  If led i is connected to I/O port x, then port_table[i] contains
- *  &PORTx.
- */
-volatile uint8_t *port_table[NUM_LEDS] =
-{
-    &PORT(LED0_PORT),
-    &PORT(LED1_PORT),
-    &PORT(LED2_PORT),
-    &PORT(LED3_PORT),
-    &PORT(LED4_PORT),
-    &PORT(LED5_PORT),
-    &PORT(LED6_PORT),
-    &PORT(LED7_PORT),
-    &PORT(LED8_PORT),
-    &PORT(LED9_PORT),
-    &PORT(LED10_PORT),
-    &PORT(LED11_PORT),
-    &PORT(LED12_PORT),
-    &PORT(LED13_PORT),
-    &PORT(LED14_PORT),
-    &PORT(LED15_PORT),
-    &PORT(LED16_PORT),
-    &PORT(LED17_PORT)
-};
+#if !LED_SPI
 
-/*! \brief File internal lookup table from led index to PIN register
- *         address.
- *
- *  If led i is connected to I/O port x, then pin_table[i] contains &PINx.
- */
-volatile uint8_t *pin_table[NUM_LEDS] =
-{
-    &PIN(LED0_PORT),
-    &PIN(LED1_PORT),
-    &PIN(LED2_PORT),
-    &PIN(LED3_PORT),
-    &PIN(LED4_PORT),
-    &PIN(LED5_PORT),
-    &PIN(LED6_PORT),
-    &PIN(LED7_PORT),
-    &PIN(LED8_PORT),
-    &PIN(LED9_PORT),
-    &PIN(LED10_PORT),
-    &PIN(LED11_PORT),
-    &PIN(LED12_PORT),
-    &PIN(LED13_PORT),
-    &PIN(LED14_PORT),
-    &PIN(LED15_PORT),
-    &PIN(LED16_PORT),
-    &PIN(LED17_PORT)
-};
+#if NUM_LEDS != 18
+#error "The pin map in config.h has 18 LEDs"
+#endif
 
-/*! \brief File internal lookup table from led index to DDR register
- *         address.
- *
- *  If led i is connected to I/O port x, then ddr_table[i] contains
- *  &DDRx.
- */
-volatile uint8_t *ddr_table[NUM_LEDS] =
-{
-    &DDR(LED0_PORT),
-    &DDR(LED1_PORT),
-    &DDR(LED2_PORT),
-    &DDR(LED3_PORT),
-    &DDR(LED4_PORT),
-    &DDR(LED5_PORT),
-    &DDR(LED6_PORT),
-    &DDR(LED7_PORT),
-    &DDR(LED8_PORT),
-    &DDR(LED9_PORT),
-    &DDR(LED10_PORT),
-    &DDR(LED11_PORT),
-    &DDR(LED12_PORT),
-    &DDR(LED13_PORT),
-    &DDR(LED14_PORT),
-    &DDR(LED15_PORT),
-    &DDR(LED16_PORT),
-    &DDR(LED17_PORT)
+/*! \brief File internal lookup table from led index to port number.
+ *
+ *  If led i is connected to I/O port x, then port_id_table[i]
+ *  contains PORT_ID_x (0 for A up to 3 for D). The table is stored
+ *  in flash.
+ */
+const uint8_t port_id_table[NUM_LEDS] PROGMEM =
+{
+    PORT_ID(LED0_PORT),
+    PORT_ID(LED1_PORT),
+    PORT_ID(LED2_PORT),
+    PORT_ID(LED3_PORT),
+    PORT_ID(LED4_PORT),
+    PORT_ID(LED5_PORT),
+    PORT_ID(LED6_PORT),
+    PORT_ID(LED7_PORT),
+    PORT_ID(LED8_PORT),
+    PORT_ID(LED9_PORT),
+    PORT_ID(LED10_PORT),
+    PORT_ID(LED11_PORT),
+    PORT_ID(LED12_PORT),
+    PORT_ID(LED13_PORT),
+    PORT_ID(LED14_PORT),
+    PORT_ID(LED15_PORT),
+    PORT_ID(LED16_PORT),
+    PORT_ID(LED17_PORT)
 };
 
 /*! \brief File internal lookup table from led index to the bitmask of
  *         the led pin relative its port.
  *
  *  If led i is connected to bit j on its I/O port, then bitmask_table[i]
- *  contains 1<<j.
+ *  contains 1<<j. The table is stored in flash.
  */
-uint8_t bitmask_table[NUM_LEDS] =
+const uint8_t bitmask_table[NUM_LEDS] PROGMEM =
 {
     1<<LED0_BIT,
     1<<LED1_BIT,
@@ -126,14 +101,18 @@ uint8_t bitmask_table[NUM_LEDS] =
     1<<LED17_BIT
 };
 
+#endif
+
 /*! \brief File internal lookup table from LED intensity level to PWM
  *         duty cycle.
  *
  *  This table is needed since the intensity of a PWM'ed LED when
  *  perceived by a human is not proportional to the PWM duty
- *  cycle. These values follow a quadratic curve.
+ *  cycle. These values follow a quadratic curve. The table is stored
+ *  in flash. With #LED_DITHER, fractional intensities are
+ *  interpolated between its entries.
  */
-uint8_t intensity_table[NUM_INTENSITIES] =
+const uint8_t intensity_table[NUM_INTENSITIES] PROGMEM =
 {
     0,
     1,
@@ -155,45 +134,1032 @@ uint8_t intensity_table[NUM_INTENSITIES] =
     255
 };
 
-/*! \brief Initialize led I/O port.
+/*! \brief File internal clock select bits for timer 0.
  *
- *  #port_table and #ddr_table are used to configure all #NUM_LEDS leds as
- *  outputs initalized to 0.
+ *  clk/8 when the LEDs are on I/O pins. With #LED_SPI a timer count is
+ *  the shortest bitplane, in which the next plane is shifted out:
+ *  clk/256 is enough for a chain of up to 64 LEDs, and longer chains
+ *  take clk/1024.
  */
-void led_init(void)
+#if !LED_SPI
+#define TIMER0_PRESCALER (1<<CS01)
+#define TIMER0_DIVIDER 8
+#elif NUM_LEDS <= 64
+#define TIMER0_PRESCALER (1<<CS02)
+#define TIMER0_DIVIDER 256
+#else
+#define TIMER0_PRESCALER ((1<<CS02) | (1<<CS00))
+#define TIMER0_DIVIDER 1024
+#endif
+
+#if !LED_SPI
+/*! \brief File internal number of slots in a PWM frame.
+ *
+ *  Each slot but the last of a frame takes at least #LED_MAX_LIT LEDs,
+ *  so a frame never needs more slots than this. Frames that need fewer
+ *  are padded with dark slots, which keeps the length of the frame,
+ *  and thus the brightness of a duty cycle, constant.
+ */
+#define MAX_SLOTS ((NUM_LEDS + LED_MAX_LIT - 1) / LED_MAX_LIT)
+#endif
+
+/*! \brief File internal length of a PWM frame in timer counts.
+ *
+ *  A slot, and with #LED_SPI the whole frame, takes the 255 counts of
+ *  the longest duty cycle.
+ */
+#if LED_SPI
+#define PWM_FRAME_LENGTH 255UL
+#else
+#define PWM_FRAME_LENGTH (MAX_SLOTS * 255UL)
+#endif
+
+#if PWM_FRAME_LENGTH * TIMER0_DIVIDER > F_CPU / FRAME_RATE
+#error "A PWM frame is longer than a frame of the frame clock (lower FRAME_RATE)"
+#endif
+
+/*! \brief Number of complete PWM frames shown since #led_init.
+ *
+ *  Incremented by the PWM engine each time all LEDs have been
+ *  shown.
+ */
+volatile uint8_t led_frame;
+
+/*! \brief Number of frames that #display_for could not show in time.
+ *
+ *  Wraps around, so compare it with differences.
+ */
+uint8_t frame_overruns;
+
+/*! \brief File internal frame of the \ref frame_clock at which the
+ *         last #display_for wait ended.
+ */
+static uint8_t frame_deadline;
+
+/*! \brief File internal flag telling #display_for that there is no
+ *         last wait to count from, see #display_reset.
+ */
+static uint8_t frame_reset = 1;
+
+/*! \brief File internal index of the first LED not yet scheduled in
+ *         the current frame.
+ *
+ *  The frame ends when this reaches #NUM_LEDS.
+ */
+static uint8_t cursor;
+
+/*! \brief File internal pointer to the frame being shown.
+ *
+ *  Only replaced at frame boundaries, so a frame is never shown half
+ *  old and half new. The frame is only read by #load_frame when it is
+ *  taken (see #take_frame), so the array passed to #led_show is free
+ *  again from then on.
+ */
+static const uint8_t *shown_frame;
+
+/*! \brief File internal pointer to the frame to show from the next
+ *         frame boundary, or 0 if there is none.
+ */
+static const uint8_t * volatile next_frame;
+
+/*! \brief File internal index in #shown_frame of LED 0, and the same
+ *         for #next_frame.
+ *
+ *  Frames are ring buffers, see #led_show.
+ */
+static uint8_t shown_head;
+static uint8_t next_head;
+
+/*! \brief File internal flag telling the PWM engine to rebuild its
+ *         schedule at the next frame boundary.
+ *
+ *  Set when the duty cycles of the LEDs change, and when the engine
+ *  is started. Frames that show the same duty cycles as the last one
+ *  leave it clear, so the engine reuses its schedule and only does
+ *  the output work.
+ */
+static uint8_t frame_dirty;
+
+/*! \brief File internal function that gets the index of a LED in the
+ *         shown frame.
+ */
+static inline uint8_t frame_index(uint8_t led)
+{
+    // Does not overflow for more than 128 LEDs
+    if (led >= NUM_LEDS - shown_head) {
+        return led - (NUM_LEDS - shown_head);
+    }
+    return led + shown_head;
+}
+
+/*! \brief File internal duty cycles of the LEDs in the current PWM
+ *         frame, in LED order.
+ *
+ *  Looked up in #intensity_table only when the shown frame changes,
+ *  rather than for every LED of every PWM frame.
+ */
+static uint8_t frame_duty[NUM_LEDS];
+
+#if LED_DITHER
+
+/*! \brief File internal copy of the shown frame, in LED order.
+ *
+ *  With #LED_DITHER the duty cycles are worked out again for every PWM
+ *  frame, so the frame is copied here when it is taken.
+ */
+static uint8_t frame_copy[LED_FRAME_SIZE];
+
+/*! \brief File internal accumulated dithering error of each LED, in
+ *         1/256 duty cycle steps.
+ */
+static uint8_t dither_error[NUM_LEDS];
+
+#endif
+
+/*! \brief File internal function that loads the duty cycles of the
+ *         shown frame into #frame_duty.
+ *
+ *  With #LED_DITHER this is done for every PWM frame. The duty cycle
+ *  of intensity i + f/256 is interpolated between entries i and i + 1
+ *  of #intensity_table, giving a 16 bit duty cycle with 8 fractional
+ *  bits. The fraction is added to the error of the LED, and the
+ *  integer duty cycle is rounded up in the frames where the error
+ *  overflows. Over 256 frames the LED is thus lit for the exact 16
+ *  bit duty cycle, while each frame is still 8 bit PWM.
+ *
+ *  Sets #frame_dirty if any duty cycle changed.
+ */
+static void load_frame(void)
 {
+    uint8_t led;
+    uint8_t k;
     uint8_t i;
+    uint8_t x;
+#if LED_DITHER
+    uint8_t f;
+    uint16_t step;
+#endif
 
-    // Initialize each led port into a known state
-    for (i = 0; i < NUM_LEDS; i++) {
-        // Set output value to 0
-        *port_table[i] &= ~bitmask_table[i];
-        // Config the I/O pin as output
-        *ddr_table[i] |= bitmask_table[i];
+    k = shown_head;
+    for (led = 0; led < NUM_LEDS; led++) {
+        i = shown_frame[k];
+#if LED_DITHER
+        f = shown_frame[NUM_LEDS + k];
+#endif
+        if (++k == NUM_LEDS) {
+            k = 0;
+        }
+        x = pgm_read_byte(&intensity_table[i]);
+#if LED_DITHER
+        if (f != 0 && i < MAX_INTENSITY) {
+            step = (uint8_t)(pgm_read_byte(&intensity_table[i + 1]) - x);
+            step = step * f + dither_error[led];
+            x += step >> 8;
+            dither_error[led] = step;
+        }
+#endif
+        if (x != frame_duty[led]) {
+            frame_duty[led] = x;
+            frame_dirty = 1;
+        }
     }
 }
 
-/*! \brief Turn on a LED.
+/*! \brief File internal function that takes a frame queued with
+ *         #led_show and loads its duty cycles.
  *
- *  \warning The AVR cannot supply enough current for all LEDs at the
- *           same time. Use #led_display to safely light a LED.
+ *  After this, the array of the frame is no longer read.
+ */
+static void take_frame(const uint8_t *frame, uint8_t head)
+{
+#if LED_DITHER
+    uint8_t led;
+
+    for (led = 0; led < NUM_LEDS; led++) {
+        frame_copy[led] = frame[head];
+        frame_copy[NUM_LEDS + led] = frame[NUM_LEDS + head];
+        if (++head == NUM_LEDS) {
+            head = 0;
+        }
+    }
+    shown_frame = frame_copy;
+    shown_head = 0;
+#else
+    shown_frame = frame;
+    shown_head = head;
+#endif
+    load_frame();
+}
+
+/*! \brief File internal function that starts the next slot.
  *
- *  \param led The index of the LED to turn on (range from 0 to
+ *  If all LEDs of the frame have been shown, this is a frame
+ *  boundary: #led_frame is incremented and a frame queued with
+ *  #led_show replaces the shown one.
+ *
+ *  \return 1 if this is a frame boundary and the engine must rebuild
+ *          its schedule from #frame_duty, otherwise 0.
+ */
+static inline uint8_t next_slot(void)
+{
+    uint8_t dirty;
+
+    if (cursor != NUM_LEDS) {
+        return 0;
+    }
+    cursor = 0;
+    led_frame++;
+    if (next_frame) {
+        take_frame(next_frame, next_head);
+        next_frame = 0;
+#if LED_DITHER
+    } else {
+        load_frame();
+#endif
+    }
+    dirty = frame_dirty;
+    frame_dirty = 0;
+    return dirty;
+}
+
+/*! \brief File internal function that gets the duty cycle of a LED in
+ *         the current PWM frame.
+ */
+static inline uint8_t duty_cycle(uint8_t led)
+{
+    return frame_duty[led];
+}
+
+#if !LED_SPI
+
+/*! \brief File internal function that writes one byte to each port.
+ *
+ *  bytes[PORT_ID_x] holds the wanted state of the LED bits of PORTx.
+ *  The LED masks are known at compile time, so each port with LEDs
+ *  on it is written exactly once, and ports without LEDs are not
+ *  touched at all. This takes the same number of cycles no matter
+ *  which LEDs change. Pins that are not LEDs (such as the button
+ *  pull-up) keep their state.
+ */
+static inline void write_ports(const uint8_t *bytes)
+{
+#if LED_MASK_A
+    PORTA = (PORTA & ~LED_MASK_A) | bytes[PORT_ID_A];
+#endif
+#if LED_MASK_B
+    PORTB = (PORTB & ~LED_MASK_B) | bytes[PORT_ID_B];
+#endif
+#if LED_MASK_C
+    PORTC = (PORTC & ~LED_MASK_C) | bytes[PORT_ID_C];
+#endif
+#if LED_MASK_D
+    PORTD = (PORTD & ~LED_MASK_D) | bytes[PORT_ID_D];
+#endif
+}
+
+/*! \brief File internal function that turns off all LEDs.
+ */
+static void leds_off(void)
+{
+    uint8_t off[NUM_PORTS] = { 0 };
+
+    write_ports(off);
+}
+
+#endif
+
+#if LED_SPI
+
+/*! \brief File internal pins of the hardware SPI, all on port B.
+ *
+ *  SS is not used, but must be an output for the SPI to stay in
+ *  master mode.
+ */
+#define SPI_SS_BIT 2
+#define SPI_MOSI_BIT 3
+#define SPI_SCK_BIT 5
+
+/*! \brief File internal bitplanes of the current PWM frame.
+ *
+ *  Bit n of the duty cycle of LED 8k + b is bit b of
+ *  spi_planes[n][k]. Plane n is shown for 2^n timer counts.
+ */
+static uint8_t spi_planes[8][LED_SPI_BYTES];
+
+/*! \brief File internal index of the bitplane being shown.
+ */
+static uint8_t spi_plane;
+
+/*! \brief File internal timer count at which the current bitplane
+ *         started.
+ */
+static uint8_t spi_time;
+
+/*! \brief File internal function that shifts a bitplane into the
+ *         chain.
+ *
+ *  The last register of the chain is shifted first. The outputs keep
+ *  showing the last latched plane meanwhile. At clk/2 a byte takes 16
+ *  cycles, and the next byte is loaded as soon as it is done.
+ */
+static void spi_shift(const uint8_t *plane)
+{
+    uint8_t k;
+
+    k = LED_SPI_BYTES;
+    do {
+        SPDR = plane[--k];
+        while (!(SPSR & (1<<SPIF))) {
+            // Busy wait for the byte to be shifted out
+        }
+    } while (k);
+}
+
+/*! \brief File internal function that copies the shifted in bitplane
+ *         to the outputs of the chain.
+ */
+static inline void spi_latch(void)
+{
+    PORT(LED_LATCH_PORT) |= 1<<LED_LATCH_BIT;
+    PORT(LED_LATCH_PORT) &= ~(1<<LED_LATCH_BIT);
+    hal_latch();
+}
+
+/*! \brief File internal function that turns the duty cycles of the
+ *         shown frame into bitplanes.
+ *
+ *  The bitplanes are the schedule of the engine, and are only rebuilt
+ *  when the duty cycles change.
+ */
+static void spi_build_planes(void)
+{
+    uint8_t led;
+    uint8_t n, k;
+    uint8_t x;
+    uint8_t mask;
+
+    for (n = 0; n < 8; n++) {
+        for (k = 0; k < LED_SPI_BYTES; k++) {
+            spi_planes[n][k] = 0;
+        }
+    }
+    k = 0;
+    mask = 1;
+    for (led = 0; led < NUM_LEDS; led++) {
+        x = duty_cycle(led);
+        for (n = 0; x != 0; n++) {
+            if (x & 1) {
+                spi_planes[n][k] |= mask;
+            }
+            x >>= 1;
+        }
+        mask <<= 1;
+        if (mask == 0) {
+            mask = 1;
+            k++;
+        }
+    }
+}
+
+/*! \brief File internal function that turns off all LEDs.
+ */
+static void leds_off(void)
+{
+    uint8_t k;
+
+    for (k = 0; k < LED_SPI_BYTES; k++) {
+        spi_planes[0][k] = 0;
+    }
+    spi_shift(spi_planes[0]);
+    spi_latch();
+}
+
+/*! \brief File internal function that starts timer 0.
+ *
+ *  Timer 0 runs freely in normal mode, and compare match A is moved
+ *  forward to the end of each bitplane.
+ */
+static void engine_start(void)
+{
+    // Let the first interrupt latch the dark chain as the last plane
+    // of a frame, and build the first frame meanwhile
+    spi_plane = 6;
+    spi_time = 1 - (1 << 6);
+    OCR0A = 1;
+    TCNT0 = 0;
+    TIMSK0 = 1<<OCIE0A;
+    TCCR0A = TIMER0_PRESCALER;
+}
+
+/*! \brief Bitplane interrupt service routine.
+ *
+ *  Latches the bitplane that was shifted in during the last one, and
+ *  shifts in the one after it. The longest plane is the last of a
+ *  frame, so the frame boundary and the bitplanes of the next frame
+ *  are computed during it. All LEDs make up one slot, so every call
+ *  of #next_slot is a frame boundary.
+ */
+ISR(TIMER0_COMPA_vect)
+{
+    TRACE_ISR();
+    spi_latch();
+    spi_time += 1 << spi_plane;
+    spi_plane = (spi_plane + 1) & 7;
+    OCR0A = spi_time + (1 << spi_plane);
+    if (spi_plane == 7) {
+        if (next_slot()) {
+            spi_build_planes();
+        }
+        cursor = NUM_LEDS;
+    }
+    spi_shift(spi_planes[(spi_plane + 1) & 7]);
+}
+
+#elif LED_BAM
+
+/*! \brief File internal number of the first bitplane that is timed
+ *         by the timer interrupt.
+ *
+ *  The shorter planes below it last only a few timer counts, which is
+ *  less than the interrupt overhead. They are instead shown with busy
+ *  waiting from the slot boundary.
+ */
+#define BAM_FIRST_TIMED_PLANE 3
+
+/*! \brief File internal bitplanes of the current slot.
+ *
+ *  Bit n of the duty cycle of each LED in the slot ends up in
+ *  bam_planes[n][PORT_ID_x] for the port x of the LED. Plane n is
+ *  shown for 2^n timer counts.
+ */
+static uint8_t bam_planes[8][NUM_PORTS];
+
+/*! \brief File internal flag telling whether #bam_planes hold all
+ *         LEDs of the frame, which then fits in a single slot.
+ *
+ *  The planes are then only rebuilt when the duty cycles change.
+ *  Frames of several slots rebuild the planes of each slot as it
+ *  starts, since keeping them for every slot would take 32 bytes of
+ *  RAM per slot.
+ */
+static uint8_t bam_whole_frame;
+
+/*! \brief File internal number of slots of the frame started so far.
+ */
+static uint8_t bam_slot;
+
+/*! \brief File internal index of the bitplane being shown.
+ */
+static uint8_t bam_plane;
+
+/*! \brief File internal timer count at which the current bitplane
+ *         started.
+ */
+static uint8_t bam_time;
+
+/*! \brief File internal function that turns the duty cycles of the
+ *         next #LED_MAX_LIT LEDs that are not dark into bitplanes.
+ *
+ *  Dark LEDs are skipped, so they take no time. Sets
+ *  #bam_whole_frame if the slot starts the frame and holds all its
+ *  lit LEDs.
+ */
+static void bam_build_planes(void)
+{
+    uint8_t i, n;
+    uint8_t x;
+    uint8_t id;
+    uint8_t mask;
+
+    for (i = 0; i < NUM_PORTS; i++) {
+        for (n = 0; n < 8; n++) {
+            bam_planes[n][i] = 0;
+        }
+    }
+    bam_whole_frame = cursor == 0;
+    i = 0;
+    while (cursor < NUM_LEDS) {
+        x = duty_cycle(cursor);
+        if (x != 0) {
+            if (i == LED_MAX_LIT) {
+                bam_whole_frame = 0;
+                break;
+            }
+            id = pgm_read_byte(&port_id_table[cursor]);
+            mask = pgm_read_byte(&bitmask_table[cursor]);
+            for (n = 0; n < 8; n++) {
+                if (x & 1) {
+                    bam_planes[n][id] |= mask;
+                }
+                x >>= 1;
+            }
+            i++;
+        }
+        cursor++;
+    }
+}
+
+/*! \brief File internal function that ends the current slot and
+ *         starts the next.
+ *
+ *  The LEDs of the current slot are turned off, and the bitplanes of
+ *  the next slot are built, unless they already hold the whole frame
+ *  and its duty cycles have not changed (see #bam_whole_frame). The
+ *  short planes are then shown with busy waiting, and the first timed
+ *  plane is left to the timer. Once all LEDs of the frame have been
+ *  shown, the frame is padded to #MAX_SLOTS with dark slots.
+ */
+static void bam_next_slot(void)
+{
+    uint8_t off[NUM_PORTS];
+    uint8_t i, n;
+    uint8_t t;
+
+    for (i = 0; i < NUM_PORTS; i++) {
+        off[i] = 0;
+    }
+    write_ports(off);
+
+    if (bam_slot == MAX_SLOTS) {
+        bam_slot = 0;
+    }
+    bam_slot++;
+    if (bam_slot != 1 && cursor == NUM_LEDS) {
+        // A dark slot, as long as the eight planes
+        bam_plane = 7;
+        OCR0A = TCNT0 + 255;
+        return;
+    }
+
+    if (next_slot() || !bam_whole_frame) {
+        bam_build_planes();
+    } else {
+        cursor = NUM_LEDS;
+    }
+
+    t = TCNT0;
+    for (n = 0; n < BAM_FIRST_TIMED_PLANE; n++) {
+        write_ports(bam_planes[n]);
+        t += 1 << n;
+        while ((int8_t)(TCNT0 - t) < 0) {
+            // Busy wait for the end of the short plane
+        }
+    }
+    write_ports(bam_planes[n]);
+    bam_plane = n;
+    bam_time = t;
+    OCR0A = t + (1 << n);
+}
+
+/*! \brief File internal function that starts timer 0.
+ *
+ *  Timer 0 runs freely in normal mode, and compare match A is moved
+ *  forward to the end of each bitplane.
+ */
+static void engine_start(void)
+{
+    // Let the first interrupt end the (empty) last plane of a slot
+    bam_plane = 7;
+    bam_slot = 0;
+    OCR0A = 1;
+    TCNT0 = 0;
+    TIMSK0 = 1<<OCIE0A;
+    TCCR0A = TIMER0_PRESCALER;
+}
+
+/*! \brief Bitplane interrupt service routine.
+ *
+ *  Shows the next bitplane of the slot, or starts the next slot when
+ *  all eight planes have been shown.
+ */
+ISR(TIMER0_COMPA_vect)
+{
+    TRACE_ISR();
+    bam_time += 1 << bam_plane;
+    bam_plane++;
+    if (bam_plane == 8) {
+        bam_next_slot();
+    } else {
+        write_ports(bam_planes[bam_plane]);
+        OCR0A = bam_time + (1 << bam_plane);
+    }
+}
+
+#else
+
+/*! \brief File internal length of a slot in timer counts.
+ *
+ *  A LED with duty cycle x (from #intensity_table) is lit for x of
+ *  these counts. Timer 0 runs in CTC mode with OCR0A = SLOT_LENGTH -
+ *  1, so compare match A marks the slot boundaries. Every slot has
+ *  this length, whatever the frame shows, so a duty cycle always means
+ *  the same brightness.
+ */
+#define SLOT_LENGTH 255
+
+/*! \brief File internal value for OCR0B and #lane_time meaning "no
+ *         pending event".
+ *
+ *  The timer never counts past SLOT_LENGTH - 1, so this compare value
+ *  never matches.
+ */
+#define NO_EVENT 255
+
+/*! \brief File internal number of timer counts within which an event
+ *         is busy waited for.
+ *
+ *  The compare match interrupt would not get to events this close to
+ *  the current timer count any sooner: taking it and saving the
+ *  registers is estimated at about 40 cycles, 5 counts at clk/8 (see
+ *  led_event_isr_max of "make bench"; not yet measured under simavr).
+ *  #fire_events waits for them instead, so that no LED is turned off
+ *  before it has been lit for its duty cycle.
+ */
+#define EVENT_MARGIN 5
+
+/*! \brief File internal schedule of the slots of a frame.
+ *
+ *  Lane j of slot s ends before LED schedule_ends[s][j], for the first
+ *  schedule_slots slots; the others are dark. The last lane of the
+ *  last of these ends at #NUM_LEDS. The schedule is only rebuilt when
+ *  the duty cycles change, see #build_schedule.
+ */
+static uint8_t schedule_ends[MAX_SLOTS][LED_MAX_LIT];
+static uint8_t schedule_slots;
+
+/*! \brief File internal index in the frame of the next slot.
+ */
+static uint8_t slot;
+
+/*! \brief File internal state of the lanes of the current slot.
+ *
+ *  Each slot has #LED_MAX_LIT lanes. A lane is a run of consecutive
+ *  LEDs that are lit one after another, each for its duty cycle, so
+ *  at most one LED per lane is lit at any time. lane_led is the LED
+ *  currently lit in the lane, lane_end the index after the last LED
+ *  of the lane (the row of the slot in #schedule_ends), and lane_time
+ *  the time at which lane_led is to be turned off.
+ */
+static uint8_t lane_led[LED_MAX_LIT];
+static const uint8_t *lane_end;
+static uint8_t lane_time[LED_MAX_LIT];
+
+/*! \brief File internal port bytes of the LEDs currently lit.
+ */
+static uint8_t lane_ports[NUM_PORTS];
+
+/*! \brief File internal function that starts timer 0.
+ *
+ *  Timer 0 runs in CTC mode. Compare match A marks the slot
+ *  boundaries, and compare match B the LED events within a slot.
+ */
+static void engine_start(void)
+{
+    uint8_t j;
+
+    for (j = 0; j < LED_MAX_LIT; j++) {
+        lane_time[j] = NO_EVENT;
+    }
+    slot = 0;
+    OCR0A = SLOT_LENGTH - 1;
+    OCR0B = NO_EVENT;
+    TCNT0 = 0;
+    TIMSK0 = (1<<OCIE0A) | (1<<OCIE0B);
+    TCCR0A = (1<<CTC0) | TIMER0_PRESCALER;
+}
+
+/*! \brief File internal function that lights the next LED of a lane.
+ *
+ *  Dark LEDs are skipped. If the lane has no more LEDs to light, or
+ *  the LED stays lit until the slot boundary, no event is scheduled
+ *  for the lane.
+ *
+ *  \param j The lane.
+ *  \param t The time at which the LED is turned on.
+ */
+static void lane_next(uint8_t j, uint8_t t)
+{
+    uint8_t led;
+    uint8_t x;
+
+    led = lane_led[j];
+    while (++led < lane_end[j]) {
+        x = duty_cycle(led);
+        if (x != 0) {
+            lane_ports[pgm_read_byte(&port_id_table[led])] |=
+                pgm_read_byte(&bitmask_table[led]);
+            lane_led[j] = led;
+            if ((uint16_t)t + x >= SLOT_LENGTH) {
+                lane_time[j] = NO_EVENT;
+            } else {
+                lane_time[j] = t + x;
+            }
+            return;
+        }
+    }
+    lane_led[j] = led;
+    lane_time[j] = NO_EVENT;
+}
+
+/*! \brief File internal function that fires all events that are due.
+ *
+ *  The events are fired in time order. For the earliest one, the lanes
+ *  that are due turn off their LED and move on to the next, and the
+ *  port bytes are written. An event more than #EVENT_MARGIN counts
+ *  ahead is left to compare match B; the margin also covers the few
+ *  counts until OCR0B is written. Closer events, and any the timer has
+ *  passed while the lanes were scanned, are busy waited for or fired
+ *  at once, so a LED is never turned off early, however short its
+ *  duty cycle.
+ */
+static void fire_events(void)
+{
+    uint8_t j;
+    uint8_t led;
+    uint8_t next;
+
+    for (;;) {
+        next = NO_EVENT;
+        for (j = 0; j < LED_MAX_LIT; j++) {
+            if (lane_time[j] < next) {
+                next = lane_time[j];
+            }
+        }
+        if (next == NO_EVENT || next > TCNT0 + EVENT_MARGIN) {
+            OCR0B = next;
+            return;
+        }
+        while (TCNT0 < next) {
+        }
+        for (j = 0; j < LED_MAX_LIT; j++) {
+            if (lane_time[j] == next) {
+                led = lane_led[j];
+                lane_ports[pgm_read_byte(&port_id_table[led])] &=
+                    ~pgm_read_byte(&bitmask_table[led]);
+                lane_next(j, next);
+            }
+        }
+        write_ports(lane_ports);
+    }
+}
+
+/*! \brief File internal function that packs the LEDs of the frame
+ *         into slots.
+ *
+ *  Each lane takes consecutive LEDs as long as the sum of their duty
+ *  cycles fits in #SLOT_LENGTH, so dark LEDs take no time and dim LEDs
+ *  share a lane.
+ */
+static void build_schedule(void)
+{
+    uint8_t s, j;
+    uint8_t led;
+    uint16_t fill;
+    uint8_t x;
+
+    led = 0;
+    for (s = 0; led < NUM_LEDS; s++) {
+        for (j = 0; j < LED_MAX_LIT; j++) {
+            fill = 0;
+            while (led < NUM_LEDS) {
+                x = duty_cycle(led);
+                if (fill + x > SLOT_LENGTH) {
+                    break;
+                }
+                fill += x;
+                led++;
+            }
+            schedule_ends[s][j] = led;
+        }
+    }
+    schedule_slots = s;
+}
+
+/*! \brief Slot boundary interrupt service routine.
+ *
+ *  Starts the next slot of the frame. At a frame boundary the schedule
+ *  is first rebuilt if the duty cycles have changed. Writing the port
+ *  bytes turns off the LEDs of the previous slot and turns on the new
+ *  ones, before any of their events are fired. The events are timed
+ *  from the moment the LEDs are turned on, so the time taken to get
+ *  here (most of all to rebuild the schedule) does not shorten the
+ *  first LED of each lane; at worst the last one is cut short by the
+ *  slot boundary.
+ */
+ISR(TIMER0_COMPA_vect)
+{
+    uint8_t j;
+    uint8_t start;
+
+    TRACE_ISR();
+    // The timer is cleared on the count after the match, so wait for
+    // it, or the events of the new slot would be measured against the
+    // end of the last one
+    while (TCNT0 == OCR0A) {
+    }
+    if (slot == MAX_SLOTS) {
+        slot = 0;
+    }
+    if (slot == 0 && next_slot()) {
+        build_schedule();
+    }
+
+    for (j = 0; j < NUM_PORTS; j++) {
+        lane_ports[j] = 0;
+    }
+    if (slot < schedule_slots) {
+        lane_end = schedule_ends[slot];
+        for (j = 0; j < LED_MAX_LIT; j++) {
+            lane_led[j] = cursor - 1;
+            cursor = lane_end[j];
+            lane_next(j, 0);
+        }
+    } else {
+        for (j = 0; j < LED_MAX_LIT; j++) {
+            lane_time[j] = NO_EVENT;
+        }
+    }
+    slot++;
+    write_ports(lane_ports);
+
+    start = TCNT0;
+    for (j = 0; j < LED_MAX_LIT; j++) {
+        if (lane_time[j] != NO_EVENT) {
+            if ((uint16_t)lane_time[j] + start >= SLOT_LENGTH) {
+                lane_time[j] = NO_EVENT;
+            } else {
+                lane_time[j] += start;
+            }
+        }
+    }
+    fire_events();
+}
+
+/*! \brief LED event interrupt service routine.
+ */
+ISR(TIMER0_COMPB_vect)
+{
+    TRACE_ISR();
+    fire_events();
+}
+
+#endif
+
+/*! \brief Initialize led I/O port.
+ *
+ *  The compile time port masks are used to configure all #NUM_LEDS
+ *  leds as outputs initalized to 0. (With #LED_SPI, the SPI is set up
+ *  in master mode at clk/2 and the chain is cleared.) Then timer 0 is
+ *  started, which drives the PWM engine from its compare match
+ *  interrupts.
+ */
+void led_init(void)
+{
+#if LED_SPI
+    PORT(LED_LATCH_PORT) &= ~(1<<LED_LATCH_BIT);
+    DDR(LED_LATCH_PORT) |= 1<<LED_LATCH_BIT;
+    DDRB |= (1<<SPI_SS_BIT) | (1<<SPI_MOSI_BIT) | (1<<SPI_SCK_BIT);
+    SPCR = (1<<SPE) | (1<<MSTR);
+    SPSR = 1<<SPI2X;
+    leds_off();
+#else
+    // Set output values to 0 and config the I/O pins as outputs
+#if LED_MASK_A
+    PORTA &= ~LED_MASK_A;
+    DDRA |= LED_MASK_A;
+#endif
+#if LED_MASK_B
+    PORTB &= ~LED_MASK_B;
+    DDRB |= LED_MASK_B;
+#endif
+#if LED_MASK_C
+    PORTC &= ~LED_MASK_C;
+    DDRC |= LED_MASK_C;
+#endif
+#if LED_MASK_D
+    PORTD &= ~LED_MASK_D;
+    DDRD |= LED_MASK_D;
+#endif
+#endif
+
+    led_frame = 0;
+    cursor = NUM_LEDS;
+    frame_dirty = 1;
+    engine_start();
+}
+
+/*! \brief Stop the PWM engine and turn off all LEDs.
+ *
+ *  Timer 0 is stopped, so the MCU can be put in a sleep mode that
+ *  the timer would otherwise wake it from. #led_start starts the
+ *  engine again.
+ */
+void led_stop(void)
+{
+    TIMSK0 = 0;
+    TCCR0A = 0;
+    leds_off();
+}
+
+/*! \brief Start the PWM engine again after #led_stop.
+ *
+ *  Showing starts from a new frame.
+ */
+void led_start(void)
+{
+    cursor = NUM_LEDS;
+    frame_dirty = 1;
+    engine_start();
+}
+
+#if !LED_SPI
+
+#define LED_CASE_OFF(n) \
+    case n: PORT(LED##n##_PORT) &= ~(1<<LED##n##_BIT); break;
+#define LED_CASE_ON(n) \
+    case n: PORT(LED##n##_PORT) |= (1<<LED##n##_BIT); break;
+#define LED_CASES(c) \
+    c(0) c(1) c(2) c(3) c(4) c(5) c(6) c(7) c(8) \
+    c(9) c(10) c(11) c(12) c(13) c(14) c(15) c(16) c(17)
+
+/*! \brief Turn off a LED.
+ *
+ *  Each case is resolved from the pin map at compile time, so this
+ *  compiles to a jump table of single bit set/clear instructions.
+ *
+ *  \param led The index of the LED to turn off (range from 0 to
  *             #NUM_LEDS - 1).
  */
 void led_off(uint8_t led)
 {
-    *port_table[led] &= ~bitmask_table[led];
+    switch (led) {
+        LED_CASES(LED_CASE_OFF)
+    }
 }
 
 /*! \brief Turn on a LED.
  *
- *  \param led The index of the LED to turn off (range from 0 to
+ *  \warning The AVR cannot supply enough current for all LEDs at the
+ *           same time. Use #display_for to safely light a LED.
+ *
+ *  \param led The index of the LED to turn on (range from 0 to
  *             #NUM_LEDS - 1).
  */
 void led_on(uint8_t led)
 {
-    *port_table[led] |= bitmask_table[led];
+    switch (led) {
+        LED_CASES(LED_CASE_ON)
+    }
+}
+
+#endif
+
+/*! \brief Show a frame from the next frame boundary.
+ *
+ *  The PWM engine keeps showing the current frame until its next
+ *  frame boundary, and then switches to frame. This function returns
+ *  once the switch has been made. The engine has then loaded the duty
+ *  cycles of frame (with #LED_DITHER, a copy of it) and does not read
+ *  the array again, so it may be written to at once.
+ *
+ *  This must be called once before interrupts are enabled, to give
+ *  the engine its first frame. That first frame is taken at once,
+ *  since the engine cannot reach a frame boundary without interrupts.
+ *
+ *  The frame is a ring buffer: the intensity of LED i is found at
+ *  index (head + i) % #NUM_LEDS, so that it can be rotated by only
+ *  changing head.
+ *
+ *  \param frame An array of #LED_FRAME_SIZE bytes: #NUM_LEDS
+ *               intensities, followed by their fractions with
+ *               #LED_DITHER.
+ *  \param head The index in frame of LED 0.
+ */
+void led_show(const uint8_t *frame, uint8_t head)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        if (shown_frame) {
+            next_frame = frame;
+            next_head = head;
+        } else {
+            take_frame(frame, head);
+        }
+    }
+    while (next_frame) {
+        // Picked up by the PWM engine at the frame boundary
+        hal_idle();
+    }
+    hal_frame(frame, head);
+}
+
+/*! \brief Count the next #display_for wait from when it is called.
+ *
+ *  Called when an effect starts, since there is then no earlier frame
+ *  for its first one to be late after.
+ */
+void display_reset(void)
+{
+    frame_reset = 1;
 }
 
 /*! \brief Light the LEDs for the given times with intensities from
@@ -201,44 +1167,41 @@ void led_on(uint8_t led)
  *
  *  An array of NUM_LEDS number of bytes determines the intensity of
  *  each LED. This array is passed implicitly with the global variable
- *  #values. The LEDs are only lit during the function call; when
- *  #led_display returns all leds are turned off.
+ *  #values. The array is committed with #commit_frame and the LEDs
+ *  are lit in the background by the PWM engine, so this function only
+ *  waits on the \ref frame_clock.
+ *
+ *  The wait is counted from the end of the last wait, not from the
+ *  call, so the time taken to compute the frame does not add up. If
+ *  the clock has already ticked past the end of the last wait when
+ *  the frame has been committed, the frame is late: it is counted in
+ *  #frame_overruns, and the wait is counted from now instead.
+ *
+ *  The wait ends early, and the running effect is aborted, when the
+ *  button is pressed (see #abort_if_pressed).
  *
- *  \param ticks The number of time "ticks" to keep the LEDs lit.
+ *  \param ticks The number of frames of the \ref frame_clock to wait.
  */
 void display_for(uint8_t ticks)
 {
-    uint8_t i;
-    uint8_t j;
-    uint8_t k;
-    uint8_t x0, x1, x2;
-
-    for (k = 0; k < ticks; k++) {
-        for (i = 0; i < NUM_LEDS; i+=3) {
-            x0 = intensity_table[values[i]];
-            x1 = intensity_table[values[i+1]];
-            x2 = intensity_table[values[i+2]];
-            if (x0 > 0)
-                led_on(i);
-            if (x1 > 0)
-                led_on(i+1);
-            if (x2 > 0)
-                led_on(i+2);
-            j = 0;
-            do {
-                j++;
-                if (j == x0) {
-                    led_off(i);
-                }
-                if (j == x1) {
-                    led_off(i+1);
-                }
-                if (j == x2) {
-                    led_off(i+2);
-                }
-            } while (j < 255);
+    TRACE_EVENT(TRACE_COMPUTE_END, 0);
+    commit_frame();
+    // Waiting for the frame boundary may have taken the whole wait
+    abort_if_pressed();
+    if (clock_frame != frame_deadline) {
+        if (!frame_reset) {
+            frame_overruns++;
         }
+        frame_deadline = clock_frame;
+    }
+    frame_reset = 0;
+    frame_deadline += ticks;
+    while ((int8_t)(frame_deadline - clock_frame) > 0) {
+        // The clock and the PWM engine run from the timer interrupts
+        hal_idle();
+        abort_if_pressed();
     }
+    TRACE_EVENT(TRACE_DISPLAY_END, 0);
 }
 
 /*! @} */
@@ -19,23 +19,87 @@
  *  function must first be called to correctly configure and
  *  initialize the LED pins. (Initial state is off.)
  *
- *  The #display_for function lights the LEDs for a given time. An
- *  array of NUM_LEDS number of bytes determines the intensity of each
- *  LED. This array is passed implicitly with the global variable
- *  #values. The LEDs are only lit during the function call; when
- *  #led_display returns all leds are turned off.
+ *  The LEDs are lit in the background by a PWM engine that runs from
+ *  the timer 0 compare match interrupts. An array of NUM_LEDS number
+ *  of bytes determines the intensity of each LED. This array is
+ *  passed implicitly with the global variable #values. A frame is
+ *  shown as a number of slots, and at each slot boundary the engine
+ *  packs the next LEDs into the slot so that no more than
+ *  #LED_MAX_LIT LEDs are lit at a time. The timer then only fires
+ *  when a LED is to be turned off, leaving the CPU free to compute
+ *  the next frame. The #display_for function shows a frame for a
+ *  given number of frames of the \ref frame_clock, which is
+ *  independent of the PWM engine.
+ *
+ *  Dark LEDs take no time and dim LEDs share slots, so a dim frame
+ *  needs fewer slots than a bright one. The rest of its frame is then
+ *  dark: every frame lasts the same number of slots, so that a LED is
+ *  equally bright at a given intensity whatever the rest of the frame
+ *  shows.
+ *
+ *  The engine only switches to a new frame at a frame boundary (see
+ *  #led_show), so it never shows a frame that is half old and half
+ *  new. It looks up the duty cycles and packs the slots only when it
+ *  switches to a frame with different duty cycles, and reuses that
+ *  schedule for all the PWM frames it is shown for.
+ *
+ *  With #LED_SPI the LEDs are instead driven by a chain of shift
+ *  registers on the SPI pins, which can have many more LEDs than the
+ *  AVR has pins, and which take the LED current off the AVR. All LEDs
+ *  are then shown at once with bit angle modulation, and the current
+ *  budget does not apply.
  */
 
 /*! \addtogroup led
  *  @{
  */
 
+/*! \brief Drive the LEDs through a chain of 74HC595 shift registers
+ *
+ *  When 0 (the default), each LED is on its own I/O pin, as given in
+ *  \ref config. When 1, the LEDs are on the outputs of a chain of
+ *  74HC595 style shift registers, clocked by the hardware SPI (MOSI
+ *  and SCK) and latched with #LED_LATCH_PORT and #LED_LATCH_BIT. LED
+ *  8k + b is output Qb of the kth register from the AVR. The register
+ *  outputs are always enabled (OE tied low).
+ *
+ *  Each PWM frame is 8 bitplanes of the duty cycles of all LEDs, and
+ *  bitplane n is shown for 2^n timer counts. The next plane is
+ *  shifted in while the current one is shown, so that showing it only
+ *  takes a latch pulse.
+ *
+ *  Every LED takes a byte in two frame buffers and a bit in each of
+ *  the 8 bitplanes, so a chain of 64 LEDs needs the 512 bytes of RAM
+ *  of the ATtiny88 (MCU = attiny88 in the Makefile), built with
+ *  -DTRANSITION_FRAMES=0.
+ *
+ *  Can be set from the Makefile with -DLED_SPI=1.
+ */
+#ifndef LED_SPI
+#define LED_SPI 0
+#endif
+
 /*! \brief The number of LEDs connected to the board
  *
  *  An integer that identifies a LED should be in the range from 0 to
  *  #NUM_LEDS - 1 (inclusive).
+ *
+ *  The pin map in \ref config has 18 LEDs. With #LED_SPI it is the
+ *  length of the shift register chain, which can be set from the
+ *  Makefile with -DNUM_LEDS=n (default 64).
  */
+#ifndef NUM_LEDS
+#if LED_SPI
+#define NUM_LEDS 64
+#else
 #define NUM_LEDS 18
+#endif
+#endif
+
+/*! \brief The number of bytes of a bitplane of the shift register
+ *         chain (see #LED_SPI).
+ */
+#define LED_SPI_BYTES ((NUM_LEDS + 7) / 8)
 
 /*! \brief The number of LED intensity levels
  *
@@ -44,7 +108,7 @@
  *
  *  This value is the same as #MAX_INTENSITY + 1.
  */
-#define NUM_INTENSITIES NUM_LEDS
+#define NUM_INTENSITIES 18
 
 /*! \brief The most bright led intensity level
  *
@@ -55,9 +119,90 @@
  */
 #define MAX_INTENSITY (NUM_INTENSITIES - 1)
 
+/*! \brief Use bit angle modulation instead of event driven PWM
+ *
+ *  When 0 (the default), each LED is turned off by its own timer
+ *  event. When 1, the duty cycles of each slot are turned into 8
+ *  bitplanes of port bytes, and bitplane n is shown for 2^n timer
+ *  counts. Either way, no more than #LED_MAX_LIT LEDs are lit at a
+ *  time.
+ *
+ *  Can be set from the Makefile with -DLED_BAM=1.
+ */
+#ifndef LED_BAM
+#define LED_BAM 0
+#endif
+
+/*! \brief Add fractional intensities shown with temporal dithering
+ *
+ *  When 1, each frame holds a fraction (in 1/256 steps) for every LED
+ *  after the #NUM_LEDS intensities, which gives #MAX_LEVEL + 1
+ *  levels (about 12 bits) instead of #NUM_INTENSITIES. Each PWM frame
+ *  still uses 8 bit duty cycles, and the fractions are delivered by
+ *  accumulating the rounding error of each LED from frame to
+ *  frame. Effects that leave the fractions at 0 look exactly as
+ *  without dithering.
+ *
+ *  Can be set from the Makefile with -DLED_DITHER=1.
+ */
+#ifndef LED_DITHER
+#define LED_DITHER 0
+#endif
+
+/*! \brief The number of bytes in a frame
+ */
+#define LED_FRAME_SIZE (NUM_LEDS * (1 + LED_DITHER))
+
+#if LED_FRAME_SIZE > 255
+#error "A frame must fit in 255 bytes (lower NUM_LEDS)"
+#endif
+
+/*! \brief The most bright led level, with fractions
+ *
+ *  A level is an intensity times 256 plus its fraction.
+ */
+#define MAX_LEVEL ((uint16_t)MAX_INTENSITY << 8)
+
+/*! \brief The level of a byte from 0 to 255, from 0 to #MAX_LEVEL
+ *
+ *  x * 17.06, as MAX_LEVEL / 255, with shifts and additions, since the
+ *  AVR has no multiplier. x must be a uint8_t, and is evaluated more
+ *  than once.
+ */
+#define BYTE_TO_LEVEL(x) (((uint16_t)(x) << 4) + (x) + ((x) >> 4))
+
+#if MAX_INTENSITY != 17
+#error "BYTE_TO_LEVEL scales to MAX_INTENSITY 17"
+#endif
+
+/*! \brief The current budget: how many LEDs may be lit at a time
+ *
+ *  The AVR cannot supply current to all LEDs at once. Each slot of
+ *  the PWM engine has this many lanes, and a lane lights at most one
+ *  LED at a time. In a lane, LEDs are lit one after another as long
+ *  as their duty cycles add up to at most one slot. (With #LED_BAM,
+ *  a slot instead lights this many LEDs that are not dark.) A lower
+ *  budget takes more slots per PWM frame; below 3, #FRAME_RATE must
+ *  be lowered to fit. Not used with #LED_SPI.
+ *
+ *  Can be set from the Makefile with -DLED_MAX_LIT=n.
+ */
+#ifndef LED_MAX_LIT
+#define LED_MAX_LIT 3
+#endif
+
+extern volatile uint8_t led_frame;
+extern uint8_t frame_overruns;
+
 void led_init(void);
+void led_stop(void);
+void led_start(void);
+#if !LED_SPI
 void led_off(uint8_t led);
 void led_on(uint8_t led);
+#endif
+void led_show(const uint8_t *frame, uint8_t head);
+void display_reset(void);
 void display_for(uint8_t ticks);
 
 /*! @} */
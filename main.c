@@ -3,8 +3,10 @@
 #include <stdint.h>
 
 #include "led.h"
+#include "button.h"
 #include "blink_kit.h"
-#include "effect.h"
+#include "power.h"
+#include "frame_clock.h"
 
 /*! \mainpage Åvvekit
  *
@@ -16,10 +18,11 @@ int main(void)
 {
     cli();
 
+    power_init();
     led_init();
+    frame_clock_init();
     button_init();
     blink_kit_init();
-    effect_init();
 
     sei();
 
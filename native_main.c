@@ -0,0 +1,180 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "hal.h"
+#include "led.h"
+#include "button.h"
+#include "blink_kit.h"
+#include "power.h"
+#include "frame_clock.h"
+
+/*! \addtogroup hal
+ *  @{
+ */
+
+/*! \file native_main.c
+ *  \brief Entry point of the native build.
+ *
+ *  Runs the firmware on the simulated hardware of hal_native.c for a
+ *  given simulated time, with button presses at given times.
+ *
+ *  Usage: avvekit_native [-t ms] [-p ms]... [-c mAh] [-l] [-T file]
+ *
+ *  - -t: Simulated run time in milliseconds (default 10000).
+ *  - -p: Press the button at the given time (may be repeated).
+ *  - -c: Battery capacity for the runtime estimates (default 2000).
+ *  - -l: Print every LED transition as "cycle led on".
+ *  - -T: Write every trace event to the file, for trace_decode. Only
+ *        in builds with #TRACE (see the "trace" Makefile target).
+ *        Code runs in zero simulated time, so only the waits show.
+ *
+ *  At exit the time each LED was lit is printed, followed by the
+ *  estimated average current of each effect that has run (see
+ *  #hal_charge), how long the battery would last with it, and how many
+ *  frames it has shown late (see #get_effect_overruns; not counted
+ *  for the effect still running).
+ */
+
+#define CYCLES_PER_MS (F_CPU / 1000)
+
+/*! \brief File internal limit on the number of effects reported.
+ */
+#define MAX_REPORTED_EFFECTS 32
+
+/*! \brief File internal bookkeeping of the time each LED has been
+ *         lit.
+ */
+static uint64_t lit_cycles[NUM_LEDS];
+static uint64_t on_since[NUM_LEDS];
+static uint8_t led_lit[NUM_LEDS];
+static uint8_t log_transitions;
+static FILE *trace_file;
+
+/*! \brief File internal bookkeeping of the time and charge of each
+ *         effect.
+ */
+static uint64_t effect_cycles[MAX_REPORTED_EFFECTS];
+static uint64_t effect_charge[MAX_REPORTED_EFFECTS];
+static uint8_t effect;
+static uint64_t effect_start_cycle, effect_start_charge;
+static unsigned battery_mah = 2000;
+
+/*! \brief File internal function that adds the time and charge since
+ *         the last call to the current effect.
+ */
+static void account_effect(void)
+{
+    if (effect < MAX_REPORTED_EFFECTS) {
+        effect_cycles[effect] += hal_cycles - effect_start_cycle;
+        effect_charge[effect] += hal_charge - effect_start_charge;
+    }
+    effect_start_cycle = hal_cycles;
+    effect_start_charge = hal_charge;
+}
+
+static void record_transition(uint64_t cycle, uint8_t led, uint8_t on)
+{
+    led_lit[led] = on;
+    if (on) {
+        on_since[led] = cycle;
+    } else {
+        lit_cycles[led] += cycle - on_since[led];
+    }
+    if (log_transitions) {
+        printf("%llu %u %u\n", (unsigned long long)cycle, led, on);
+    }
+}
+
+static void print_summary(void)
+{
+    uint8_t i;
+    double ma;
+
+    fprintf(stderr, "%llu cycles simulated\n",
+            (unsigned long long)hal_cycles);
+    for (i = 0; i < NUM_LEDS; i++) {
+        if (led_lit[i]) {
+            lit_cycles[i] += hal_cycles - on_since[i];
+        }
+        fprintf(stderr, "led %2u lit %5.1f%%\n", i,
+                100.0 * lit_cycles[i] / hal_cycles);
+    }
+    account_effect();
+    for (i = 0; i < MAX_REPORTED_EFFECTS; i++) {
+        if (effect_cycles[i]) {
+            ma = effect_charge[i] / 1e6 / effect_cycles[i];
+            fprintf(stderr, "effect %2u %9.4f mA %10.0f h %3u late\n", i,
+                    ma, battery_mah / ma, get_effect_overruns(i));
+        }
+    }
+}
+
+/*! \brief File internal function that writes a trace event to
+ *         #trace_file.
+ */
+static void write_trace(const void *event, uint8_t size)
+{
+    fwrite(event, size, 1, trace_file);
+}
+
+int main(int argc, char **argv)
+{
+    int opt;
+
+    hal_end_cycle = 10000 * CYCLES_PER_MS;
+    while ((opt = getopt(argc, argv, "t:p:c:lT:")) != -1) {
+        switch (opt) {
+        case 't':
+            hal_end_cycle = strtoull(optarg, 0, 10) * CYCLES_PER_MS;
+            break;
+        case 'p':
+            hal_press_button(strtoull(optarg, 0, 10) * CYCLES_PER_MS);
+            break;
+        case 'c':
+            battery_mah = strtoul(optarg, 0, 10);
+            break;
+        case 'l':
+            log_transitions = 1;
+            break;
+        case 'T':
+            trace_file = fopen(optarg, "wb");
+            if (!trace_file) {
+                perror(optarg);
+                return 1;
+            }
+            hal_trace_hook = write_trace;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-t ms] [-p ms]... [-c mAh] [-l] "
+                    "[-T file]\n", argv[0]);
+            return 1;
+        }
+    }
+    hal_led_hook = record_transition;
+    atexit(print_summary);
+
+    cli();
+
+    power_init();
+    led_init();
+    frame_clock_init();
+    button_init();
+    blink_kit_init();
+
+    sei();
+
+    for (;;) {
+        run_next_effect();
+        account_effect();
+        effect++;
+        if (effect == get_effect_count()) {
+            effect = 0;
+        }
+    }
+
+    return 0;
+}
+
+/*! @} */
@@ -0,0 +1,393 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "hal.h"
+#include "led.h"
+#include "button.h"
+#include "blink_kit.h"
+#include "power.h"
+#include "frame_clock.h"
+
+/*! \addtogroup hal
+ *  @{
+ */
+
+/*! \file native_render.c
+ *  \brief Headless renderer that checks effects against golden files.
+ *
+ *  Runs each effect in #effect_table for a number of frames
+ *  on the simulated hardware, as fast as the host allows. For every
+ *  frame the committed #values and the duty cycle actually produced
+ *  on each LED pin are hashed, and the hashes are compared with the
+ *  golden file of the effect (golden/effectN.txt, one line "frame
+ *  values-hash duty-hash" per frame). An effect that powers down
+ *  instead gets a line "power-down lit=n timer0=on|off" with the
+ *  number of LEDs left lit and whether timer 0 still runs the PWM
+ *  engine.
+ *
+ *  Usage: avvekit_render [-n frames] [-d dir] [-u]
+ *
+ *  - -n: Number of frames per effect (default 200).
+ *  - -d: Directory of the golden files (default "golden").
+ *  - -u: Write the golden files instead of checking them.
+ *
+ *  An effect must not show any frame late (see #display_for): the
+ *  simulated code takes no time, so a late frame means that a PWM
+ *  frame does not fit in a frame of the \ref frame_clock. After the
+ *  effects, the brightness of every intensity is measured, see
+ *  #check_brightness.
+ *
+ *  The exit status is 1 if any effect differs from its golden file or
+ *  shows frames late, or the brightness check fails.
+ *  The duty cycles depend on the PWM engine, so the golden files are
+ *  made with the default build options.
+ */
+
+/*! \brief File internal FNV-1a hash of a byte array.
+ */
+static uint32_t hash(const uint8_t *bytes, uint8_t n)
+{
+    uint32_t h;
+    uint8_t i;
+
+    h = 2166136261u;
+    for (i = 0; i < n; i++) {
+        h = (h ^ bytes[i]) * 16777619u;
+    }
+    return h;
+}
+
+/*! \brief File internal settings.
+ */
+static unsigned num_frames = 200;
+static const char *golden_dir = "golden";
+static uint8_t update;
+
+/*! \brief File internal state of the effect being rendered.
+ */
+static FILE *golden;
+static uint8_t recording;
+static unsigned frame_index;
+static unsigned mismatch_frame;  // First differing frame
+static const char *mismatch_what;
+static uint8_t frame_values[NUM_LEDS];
+static uint64_t frame_cycle;
+
+/*! \brief File internal bookkeeping of the time each LED has been lit
+ *         in the current frame.
+ */
+static uint64_t lit_cycles[NUM_LEDS];
+static uint64_t on_since[NUM_LEDS];
+static uint8_t led_lit[NUM_LEDS];
+
+static void record_transition(uint64_t cycle, uint8_t led, uint8_t on)
+{
+    led_lit[led] = on;
+    if (on) {
+        on_since[led] = cycle;
+    } else {
+        lit_cycles[led] += cycle - on_since[led];
+    }
+}
+
+/*! \brief File internal function that writes or checks the line of
+ *         the frame that has just been shown.
+ */
+static void finish_frame(void)
+{
+    uint8_t duty[NUM_LEDS];
+    uint64_t length;
+    uint32_t values_hash, duty_hash;
+    unsigned f;
+    unsigned long v, d;
+    uint8_t i;
+
+    length = hal_cycles - frame_cycle;
+    for (i = 0; i < NUM_LEDS; i++) {
+        if (led_lit[i]) {
+            lit_cycles[i] += hal_cycles - on_since[i];
+            on_since[i] = hal_cycles;
+        }
+        duty[i] = (lit_cycles[i] * 255 + length / 2) / length;
+    }
+    values_hash = hash(frame_values, NUM_LEDS);
+    duty_hash = hash(duty, NUM_LEDS);
+    if (update) {
+        fprintf(golden, "%u %08lx %08lx\n", frame_index,
+                (unsigned long)values_hash, (unsigned long)duty_hash);
+    } else if (!mismatch_what) {
+        if (fscanf(golden, "%u %lx %lx", &f, &v, &d) != 3 ||
+            f != frame_index) {
+            mismatch_what = "missing in golden file";
+        } else if (v != values_hash) {
+            mismatch_what = "values differ";
+        } else if (d != duty_hash) {
+            mismatch_what = "duty cycles differ";
+        }
+        if (mismatch_what) {
+            mismatch_frame = frame_index;
+        }
+    }
+}
+
+/*! \brief File internal number of PWM frames the brightness of an
+ *         intensity is measured over.
+ */
+#define BRIGHTNESS_FRAMES 32
+
+/*! \brief File internal function that shows the led array and measures
+ *         the fraction of the time each LED is lit.
+ *
+ *  The time is measured over whole PWM frames, so that it does not
+ *  matter where in the frame a LED is lit.
+ *
+ *  \param lit The fractions, one per LED.
+ */
+static void measure_brightness(double *lit)
+{
+    uint64_t start;
+    uint8_t frame;
+    uint8_t i;
+
+    // Let the engine take the frame, and wait for the next boundary
+    display_for(1);
+    frame = led_frame;
+    while (led_frame == frame) {
+        hal_idle();
+    }
+    start = hal_cycles;
+    for (i = 0; i < NUM_LEDS; i++) {
+        lit_cycles[i] = 0;
+        on_since[i] = start;
+    }
+    frame = led_frame;
+    while ((uint8_t)(led_frame - frame) < BRIGHTNESS_FRAMES) {
+        hal_idle();
+    }
+    for (i = 0; i < NUM_LEDS; i++) {
+        if (led_lit[i]) {
+            lit_cycles[i] += hal_cycles - on_since[i];
+        }
+        lit[i] = (double)lit_cycles[i] / (hal_cycles - start);
+    }
+}
+
+/*! \brief File internal function that checks that the brightness of
+ *         the LEDs rises with their intensity.
+ *
+ *  For each intensity, all LEDs are lit at it and must be equally
+ *  bright, brighter than at the intensity below, and dark only at
+ *  intensity 0. A single LED lit at the intensity must be as bright,
+ *  so that the brightness does not depend on the rest of the frame.
+ *
+ *  "Equally" allows for 1/32 of the brightness, and for LEDs being lit
+ *  a timer count or so more or less than their duty cycle. The time of
+ *  a timer count depends on the PWM engine, so it is taken from the
+ *  brightness at intensity 1, which is lit for a single count.
+ *
+ *  \return 0 if the check passes, else 1.
+ */
+static uint8_t check_brightness(void)
+{
+    double lit[NUM_LEDS];
+    double low, high, last, one, count, slack;
+    uint8_t intensity;
+    uint8_t i;
+
+    last = 0;
+    count = 0;
+    for (intensity = 0; intensity <= MAX_INTENSITY; intensity++) {
+        clear(intensity);
+        measure_brightness(lit);
+        low = high = lit[0];
+        for (i = 1; i < NUM_LEDS; i++) {
+            if (lit[i] < low) {
+                low = lit[i];
+            }
+            if (lit[i] > high) {
+                high = lit[i];
+            }
+        }
+        // Whichever LED the middle of the led array is
+        clear(0);
+        get_led_array()[NUM_LEDS / 2] = intensity;
+        measure_brightness(lit);
+        one = 0;
+        for (i = 0; i < NUM_LEDS; i++) {
+            if (lit[i] > one) {
+                one = lit[i];
+            }
+        }
+
+        if (intensity == 0 ? high != 0 : low <= last) {
+            printf("brightness: intensity %u: lit %.4f after %.4f\n",
+                   intensity, low, last);
+            return 1;
+        }
+        if (intensity == 1) {
+            count = (low + high) / 2;
+        }
+        slack = high / 32 + 2 * count;
+        if (high - low > slack) {
+            printf("brightness: intensity %u: LEDs lit %.4f to %.4f\n",
+                   intensity, low, high);
+            return 1;
+        }
+        if (one < low - slack || one > high + slack) {
+            printf("brightness: intensity %u: single LED lit %.4f, "
+                   "all lit %.4f\n", intensity, one, low);
+            return 1;
+        }
+        last = high;
+    }
+    printf("brightness: ok\n");
+    return 0;
+}
+
+/*! \brief File internal function that writes or checks the line of
+ *         a power-down.
+ */
+static void finish_power_down(void)
+{
+    char timer[4];
+    const char *running;
+    unsigned lit, l;
+    uint8_t i;
+
+    lit = 0;
+    for (i = 0; i < NUM_LEDS; i++) {
+        lit += led_lit[i];
+    }
+    if (TIMSK0 || (TCCR0A & ((1<<CS02) | (1<<CS01) | (1<<CS00)))) {
+        running = "on";
+    } else {
+        running = "off";
+    }
+    if (update) {
+        fprintf(golden, "power-down lit=%u timer0=%s\n", lit, running);
+    } else if (!mismatch_what) {
+        if (fscanf(golden, " power-down lit=%u timer0=%3s", &l,
+                   timer) != 2) {
+            mismatch_what = "power-down missing in golden file";
+        } else if (l != lit || strcmp(timer, running) != 0) {
+            mismatch_what = "power-down differs";
+        }
+        if (mismatch_what) {
+            mismatch_frame = frame_index;
+        }
+    }
+}
+
+/*! \brief File internal function that records a power-down and wakes
+ *         up the effect, since it will not show any frames.
+ */
+static void wake_up(void)
+{
+    if (recording) {
+        finish_power_down();
+    }
+    hal_press_button(hal_cycles);
+}
+
+static void frame_shown(const uint8_t *frame, uint8_t head)
+{
+    uint8_t i;
+
+    if (!recording) {
+        return;
+    }
+    if (frame_index) {
+        finish_frame();
+    }
+    if (frame_index == num_frames) {
+        recording = 0;
+        // Make the effect return
+        button_pressed = 1;
+        return;
+    }
+    for (i = 0; i < NUM_LEDS; i++) {
+        frame_values[i] = frame[(head + i) % NUM_LEDS];
+        lit_cycles[i] = 0;
+        on_since[i] = hal_cycles;
+    }
+    frame_cycle = hal_cycles;
+    frame_index++;
+}
+
+int main(int argc, char **argv)
+{
+    char path[256];
+    uint8_t effect;
+    uint8_t failed;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:d:u")) != -1) {
+        switch (opt) {
+        case 'n':
+            num_frames = strtoul(optarg, 0, 10);
+            break;
+        case 'd':
+            golden_dir = optarg;
+            break;
+        case 'u':
+            update = 1;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-n frames] [-d dir] [-u]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+    hal_led_hook = record_transition;
+    hal_frame_hook = frame_shown;
+    hal_power_down_hook = wake_up;
+
+    cli();
+
+    power_init();
+    led_init();
+    frame_clock_init();
+    button_init();
+    blink_kit_init();
+
+    sei();
+
+    failed = 0;
+    for (effect = 0; effect < get_effect_count(); effect++) {
+        snprintf(path, sizeof(path), "%s/effect%u.txt", golden_dir, effect);
+        golden = fopen(path, update ? "w" : "r");
+        if (!golden) {
+            perror(path);
+            return 1;
+        }
+        frame_index = 0;
+        mismatch_what = 0;
+        recording = 1;
+        run_next_effect();
+        // In case the effect ended before all frames were recorded
+        recording = 0;
+        fclose(golden);
+        if (get_effect_overruns(effect)) {
+            printf("effect %u: %u frames late\n", effect,
+                   get_effect_overruns(effect));
+            failed = 1;
+        } else if (update) {
+            printf("effect %u: wrote %s\n", effect, path);
+        } else if (mismatch_what) {
+            printf("effect %u: frame %u: %s\n", effect, mismatch_frame,
+                   mismatch_what);
+            failed = 1;
+        } else {
+            printf("effect %u: ok\n", effect);
+        }
+    }
+    if (check_brightness()) {
+        failed = 1;
+    }
+    return failed;
+}
+
+/*! @} */
@@ -0,0 +1,57 @@
+
+#include "hal.h"
+#include "power.h"
+#include "led.h"
+#include "button.h"
+
+/*! \addtogroup power
+ *  @{
+ */
+
+/*! \brief Turn off unused peripherals.
+ *
+ *  Only timer 0 (the PWM engine), timer 1 (the frame clock) and the
+ *  pin change interrupt (the button) are used, so the TWI, SPI and
+ *  ADC are stopped with the power reduction register. (With #LED_SPI
+ *  the SPI drives the LEDs, and is kept.) Waiting is done in idle
+ *  sleep mode, which keeps the timers running.
+ */
+void power_init(void)
+{
+#if LED_SPI
+    PRR = (1<<PRTWI) | (1<<PRADC);
+#else
+    PRR = (1<<PRTWI) | (1<<PRSPI) | (1<<PRADC);
+#endif
+    set_sleep_mode(SLEEP_MODE_IDLE);
+}
+
+/*! \brief Sleep in power-down mode until the button is pressed.
+ *
+ *  The LEDs are turned off and the PWM engine is stopped, and the MCU
+ *  then sleeps with all clocks stopped, including the frame clock;
+ *  only the button's pin change interrupt wakes it up. The press is
+ *  left in #button_pressed.
+ *
+ *  Must be called with interrupts enabled.
+ */
+void power_down(void)
+{
+    led_stop();
+    set_sleep_mode(SLEEP_MODE_PWR_DOWN);
+    cli();
+    while (!button_pressed) {
+        sleep_enable();
+        // The instruction after sei is run before any interrupt, so a
+        // press can not slip in between the test and the sleep
+        sei();
+        sleep_cpu();
+        sleep_disable();
+        cli();
+    }
+    sei();
+    set_sleep_mode(SLEEP_MODE_IDLE);
+    led_start();
+}
+
+/*! @} */
@@ -0,0 +1,17 @@
+#ifndef POWER_H
+#define POWER_H
+
+/*! \defgroup power Power
+ *  \brief Sleep modes and power reduction
+ *
+ *  The MCU sleeps in idle mode whenever it waits for the PWM engine
+ *  (see #hal_idle), and the peripherals that are not used are turned
+ *  off with the power reduction register by #power_init. The
+ *  #power_down function puts the board in its deepest sleep mode
+ *  until the button is pressed.
+ */
+
+void power_init(void);
+void power_down(void);
+
+#endif
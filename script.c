@@ -0,0 +1,91 @@
+#include "hal.h"
+
+#include "script.h"
+#include "blink_kit.h"
+
+/*! \addtogroup script
+ *  @{
+ */
+
+/*! \brief Run a script until its next #SCRIPT_SHOW.
+ *
+ *  Meant to be called from a step function, see \ref script. The
+ *  program counter is kept in the line of the state, so the script
+ *  starts over from its first opcode when the effect does.
+ *
+ *  \param s The state of the effect.
+ *  \param script The bytecode, in flash.
+ *  \return The number of frames to show the led array for, or 0 when
+ *          the script has ended, with #SCRIPT_END or a #SCRIPT_SHOW of
+ *          0 frames.
+ */
+uint8_t script_step(struct effect_state* s, const uint8_t* script)
+{
+    const uint8_t* pc;
+    uint8_t op, arg;
+
+    pc = script + s->line;
+    for (;;) {
+        op = pgm_read_byte(pc++);
+        arg = 0;
+        if (op >= SCRIPT_CLEAR) {
+            arg = pgm_read_byte(pc++);
+        }
+        switch (op) {
+        case SCRIPT_RAMP_RIGHT:
+            ramp_right();
+            break;
+        case SCRIPT_RAMP_LEFT:
+            ramp_left();
+            break;
+        case SCRIPT_TRIANGLE:
+            triangle();
+            break;
+        case SCRIPT_ROTATE_RIGHT:
+            rotate_right();
+            break;
+        case SCRIPT_ROTATE_LEFT:
+            rotate_left();
+            break;
+        case SCRIPT_FLIP:
+            flip();
+            break;
+        case SCRIPT_CLEAR:
+            clear(arg);
+            break;
+        case SCRIPT_SHIFT_RIGHT:
+            shift_right(arg);
+            break;
+        case SCRIPT_SHIFT_LEFT:
+            shift_left(arg);
+            break;
+        case SCRIPT_SHOW:
+            s->line = pc - script;
+            return arg;
+        case SCRIPT_LOOP_I:
+            s->i = arg;
+            break;
+        case SCRIPT_LOOP_J:
+            s->j = arg;
+            break;
+        case SCRIPT_NEXT_I:
+            if (--s->i != 0) {
+                pc -= arg;
+            }
+            break;
+        case SCRIPT_NEXT_J:
+            if (--s->j != 0) {
+                pc -= arg;
+            }
+            break;
+        case SCRIPT_JUMP:
+            pc -= arg;
+            break;
+        default:
+            s->line = 0;
+            return 0;
+        }
+    }
+}
+
+/*! @} */
@@ -0,0 +1,110 @@
+#ifndef SCRIPT_H
+#define SCRIPT_H
+
+#include <stdint.h>
+#include "blink_kit.h"
+
+/*! \defgroup script Script
+ *  \brief Effects as bytecode in flash
+ *
+ *  A script is a step effect written as a string of bytecode instead
+ *  of AVR code. Each opcode is one byte, followed by one argument
+ *  byte for the opcodes from #SCRIPT_CLEAR on, and most map directly
+ *  to a blink kit primitive. A script is stored in flash and run by
+ *  #script_step, which keeps its program counter and loop counters in
+ *  the #effect_state, so a script effect is just a one line step
+ *  function:
+ *
+ *      uint8_t chase(struct effect_state* s)
+ *      {
+ *          return script_step(s, chase_script);
+ *      }
+ *
+ *  #SCRIPT_SHOW returns from the step, and the blink kit then shows
+ *  the led array, aborts the effect if the button is pressed and
+ *  crossfades between effects, as for any step effect. A typical
+ *  effect takes a few dozen bytes.
+ *
+ *  Scripts are written with the opcodes and the loop macros, which
+ *  work out the jump offsets:
+ *
+ *      static const uint8_t chase_script[] PROGMEM = {
+ *          SCRIPT_CLEAR, 0,
+ *          SCRIPT_SHIFT_RIGHT, MAX_INTENSITY,
+ *          SCRIPT_FOREVER(
+ *              SCRIPT_SHOW, FRAMES(30),
+ *              SCRIPT_ROTATE_RIGHT)
+ *      };
+ */
+
+/*! \addtogroup script
+ *  @{
+ */
+
+/*! \brief The opcodes of a script.
+ *
+ *  The opcodes before SCRIPT_CLEAR take no argument. SCRIPT_END ends
+ *  the effect, and so does SCRIPT_SHOW with argument 0, just as a
+ *  step function that returns 0.
+ */
+enum script_op {
+    SCRIPT_END,
+    SCRIPT_RAMP_RIGHT,
+    SCRIPT_RAMP_LEFT,
+    SCRIPT_TRIANGLE,
+    SCRIPT_ROTATE_RIGHT,
+    SCRIPT_ROTATE_LEFT,
+    SCRIPT_FLIP,
+    SCRIPT_CLEAR,           //!< clear(argument)
+    SCRIPT_SHIFT_RIGHT,     //!< shift_right(argument)
+    SCRIPT_SHIFT_LEFT,      //!< shift_left(argument)
+    SCRIPT_SHOW,            //!< Show for argument frames (0 ends), see #display_for
+    SCRIPT_LOOP_I,          //!< Set i to argument
+    SCRIPT_LOOP_J,          //!< Set j to argument
+    SCRIPT_NEXT_I,          //!< Decrement i, jump back argument bytes if not 0
+    SCRIPT_NEXT_J,          //!< Decrement j, jump back argument bytes if not 0
+    SCRIPT_JUMP             //!< Jump back argument bytes
+};
+
+/*! \brief Size in bytes of a piece of script, for the loop macros.
+ */
+#define SCRIPT_SIZE_(...) sizeof((const uint8_t[]){ __VA_ARGS__ })
+
+/*! \brief The jump argument that goes back over a loop body of n
+ *         bytes and its own opcode and argument.
+ *
+ *  The argument is a byte, so the body can be at most 253 bytes. A
+ *  longer one does not compile: the array in the sizeof then has a
+ *  negative size.
+ */
+#define SCRIPT_BACK_(n)                                         \
+    ((n) + 2 + 0 * sizeof(char[(n) <= 253 ? 1 : -1]))
+
+/*! \brief Run a piece of script n times (1 to 256, where 0 is 256),
+ *         counting with i.
+ *
+ *  The piece must be at most 253 bytes, see #SCRIPT_BACK_. Loops can
+ *  be nested two deep, by counting the inner loop with j, see
+ *  #SCRIPT_REPEAT_J.
+ */
+#define SCRIPT_REPEAT_I(n, ...)                                 \
+    SCRIPT_LOOP_I, (n), __VA_ARGS__,                            \
+    SCRIPT_NEXT_I, SCRIPT_BACK_(SCRIPT_SIZE_(__VA_ARGS__))
+
+/*! \brief Run a piece of script n times, counting with j.
+ */
+#define SCRIPT_REPEAT_J(n, ...)                                 \
+    SCRIPT_LOOP_J, (n), __VA_ARGS__,                            \
+    SCRIPT_NEXT_J, SCRIPT_BACK_(SCRIPT_SIZE_(__VA_ARGS__))
+
+/*! \brief Run a piece of script until the effect is aborted.
+ */
+#define SCRIPT_FOREVER(...)                                     \
+    __VA_ARGS__,                                                \
+    SCRIPT_JUMP, SCRIPT_BACK_(SCRIPT_SIZE_(__VA_ARGS__))
+
+uint8_t script_step(struct effect_state* s, const uint8_t* script);
+
+/*! @} */
+
+#endif
@@ -0,0 +1,42 @@
+
+#include "hal.h"
+#include "trace.h"
+#include "frame_clock.h"
+
+/*! \addtogroup trace
+ *  @{
+ */
+
+#if TRACE
+
+#if TRACE_SIZE & (TRACE_SIZE - 1)
+#error "TRACE_SIZE must be a power of two"
+#endif
+
+/*! \brief The trace ring buffer.
+ */
+struct trace trace;
+
+/*! \brief Write an event to the ring buffer.
+ *
+ *  Use the #TRACE_EVENT macro instead, which compiles to nothing
+ *  without #TRACE.
+ */
+void trace_event(uint8_t id)
+{
+    struct trace_event* e;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        e = &trace.events[trace.head];
+        trace.head = (trace.head + 1) & (TRACE_SIZE - 1);
+        e->id = id;
+        e->frame = clock_frame;
+        e->time = TCNT1;
+        e->isrs = trace.isrs;
+    }
+    hal_trace(e, TRACE_EVENT_SIZE);
+}
+
+#endif
+
+/*! @} */
@@ -0,0 +1,134 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+/*! \defgroup trace Trace
+ *  \brief Timestamped events from the hot paths of the firmware
+ *
+ *  When built with -DTRACE=1, #display_for, #run_next_effect,
+ *  #should_exit and the blink kit primitives write events to a small
+ *  ring buffer, #trace. Each event has the frame of the \ref
+ *  frame_clock and the count of timer 1 within it, and the number of
+ *  interrupts taken so far. Otherwise the hooks compile to nothing.
+ *
+ *  The buffer can be read out with a debugger or from simavr (see
+ *  bench_host.c), and the native build can write every event to a
+ *  file (see native_main.c). The trace_decode host program turns
+ *  either into compute and display time per effect, a histogram of
+ *  the compute time per frame, and the interrupts taken meanwhile.
+ *
+ *  This header is shared by the firmware and the host programs.
+ */
+
+/*! \addtogroup trace
+ *  @{
+ */
+
+/*! \brief Set to 1 to build with the trace hooks.
+ */
+#ifndef TRACE
+#define TRACE 0
+#endif
+
+/*! \brief The number of events in the ring buffer. A power of two.
+ *
+ *  Each event takes #TRACE_EVENT_SIZE bytes of RAM.
+ */
+#ifndef TRACE_SIZE
+#define TRACE_SIZE 16
+#endif
+
+/*! \brief Kinds of trace events.
+ *
+ *  The argument of the event is the effect index for
+ *  TRACE_EFFECT_START and TRACE_EFFECT_END, the returned value for
+ *  TRACE_SHOULD_EXIT, and a #trace_primitive for TRACE_ENTER and
+ *  TRACE_LEAVE. TRACE_COMPUTE_END is written when #display_for is
+ *  called and TRACE_DISPLAY_END when it returns.
+ */
+enum trace_kind {
+    TRACE_EFFECT_START,
+    TRACE_EFFECT_END,
+    TRACE_COMPUTE_END,
+    TRACE_DISPLAY_END,
+    TRACE_SHOULD_EXIT,
+    TRACE_ENTER,
+    TRACE_LEAVE,
+};
+
+/*! \brief The blink kit primitives, as arguments of TRACE_ENTER and
+ *         TRACE_LEAVE events.
+ */
+enum trace_primitive {
+    TRACE_CLEAR,
+    TRACE_RAMP_RIGHT,
+    TRACE_RAMP_LEFT,
+    TRACE_TRIANGLE,
+    TRACE_ROTATE_RIGHT,
+    TRACE_ROTATE_LEFT,
+    TRACE_SHIFT_RIGHT,
+    TRACE_SHIFT_LEFT,
+    TRACE_FLIP,
+    TRACE_GET_LED_ARRAY,
+    TRACE_WAVE_RENDER,
+    TRACE_DRAW_SHAPE,
+    TRACE_SPRITE_RENDER,
+    TRACE_CLIP_STEP,
+    TRACE_NUM_PRIMITIVES
+};
+
+/*! \brief The id byte of an event: the kind in the top 3 bits and
+ *         the argument in the low 5.
+ */
+#define TRACE_ID(kind, arg) (((kind) << 5) | ((arg) & 0x1f))
+#define TRACE_KIND(id) ((id) >> 5)
+#define TRACE_ARG(id) ((id) & 0x1f)
+
+/*! \brief A trace event.
+ */
+struct trace_event {
+    uint8_t id;
+    uint8_t frame;   // Low byte of #clock_frame
+    uint16_t time;   // TCNT1, counts of 8 cycles since the frame began
+    uint8_t isrs;    // Interrupts taken, wrapping
+};
+
+/*! \brief Size of a #trace_event in the firmware's (packed) layout.
+ */
+#define TRACE_EVENT_SIZE 5
+
+/*! \brief The ring buffer.
+ *
+ *  events[head] is the oldest event, or unused if fewer than
+ *  #TRACE_SIZE events have been written.
+ */
+struct trace {
+    uint8_t head;
+    volatile uint8_t isrs;
+    struct trace_event events[TRACE_SIZE];
+};
+
+/*! \brief Size of a #trace in the firmware's layout, for dumps.
+ */
+#define TRACE_DUMP_SIZE (2 + TRACE_SIZE * TRACE_EVENT_SIZE)
+
+#if TRACE
+
+extern struct trace trace;
+
+void trace_event(uint8_t id);
+
+#define TRACE_EVENT(kind, arg) trace_event(TRACE_ID(kind, arg))
+#define TRACE_ISR() (trace.isrs++)
+
+#else
+
+#define TRACE_EVENT(kind, arg) do { } while (0)
+#define TRACE_ISR() do { } while (0)
+
+#endif
+
+/*! @} */
+
+#endif
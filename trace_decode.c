@@ -0,0 +1,335 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "trace.h"
+#include "frame_clock.h"
+
+/*! \addtogroup trace
+ *  @{
+ */
+
+/*! \file trace_decode.c
+ *  \brief Host program that reports on a trace.
+ *
+ *  Usage: trace_decode [-d] [-r rate] [-f hz] [-i cycles] file
+ *
+ *  - -d: The file is a dump of the #trace ring buffer, as read from
+ *        the device or simavr. Otherwise it is the stream of events
+ *        written by avvekit_native -T.
+ *  - -r: The #FRAME_RATE of the build (default as in frame_clock.h).
+ *  - -f: The F_CPU of the build (default 8000000).
+ *  - -i: The mean cycles taken by an interrupt (e.g. from "make
+ *        bench"), to estimate the time they take from the compute
+ *        phase.
+ *
+ *  For each effect it reports the time spent computing frames (from
+ *  the end of a #display_for to the next call) and displaying them
+ *  (inside #display_for), a histogram of the compute time per frame,
+ *  and the interrupts taken while computing. Then it reports the time
+ *  spent in each blink kit primitive.
+ */
+
+/*! \brief File internal limit on the number of effects reported.
+ */
+#define MAX_EFFECTS 32
+
+/*! \brief File internal index of the effect that events before the
+ *         first TRACE_EFFECT_START belong to.
+ */
+#define UNKNOWN_EFFECT MAX_EFFECTS
+
+/*! \brief File internal number of histogram bins: eighths of a frame,
+ *         and one for a frame or more.
+ */
+#define NUM_BINS 9
+
+static const char *primitive_names[TRACE_NUM_PRIMITIVES] = {
+    [TRACE_CLEAR] = "clear",
+    [TRACE_RAMP_RIGHT] = "ramp_right",
+    [TRACE_RAMP_LEFT] = "ramp_left",
+    [TRACE_TRIANGLE] = "triangle",
+    [TRACE_ROTATE_RIGHT] = "rotate_right",
+    [TRACE_ROTATE_LEFT] = "rotate_left",
+    [TRACE_SHIFT_RIGHT] = "shift_right",
+    [TRACE_SHIFT_LEFT] = "shift_left",
+    [TRACE_FLIP] = "flip",
+    [TRACE_GET_LED_ARRAY] = "get_led_array",
+    [TRACE_WAVE_RENDER] = "wave_render",
+    [TRACE_DRAW_SHAPE] = "draw_shape",
+    [TRACE_SPRITE_RENDER] = "sprite_render",
+    [TRACE_CLIP_STEP] = "clip_step",
+};
+
+/*! \brief File internal totals of an effect, in timer 1 counts.
+ */
+static struct {
+    unsigned long long compute, display;
+    unsigned long long compute_max;
+    unsigned long frames;
+    unsigned long isrs;
+    unsigned long bins[NUM_BINS];
+} effects[MAX_EFFECTS + 1];
+
+/*! \brief File internal totals of a primitive, in timer 1 counts.
+ */
+static struct {
+    unsigned long calls;
+    unsigned long long total, max;
+    unsigned long long entered;
+    int depth;
+} primitives[TRACE_NUM_PRIMITIVES];
+
+/*! \brief File internal settings.
+ */
+static unsigned long frame_rate = FRAME_RATE;
+static unsigned long f_cpu = 8000000;
+static double isr_cycles;
+
+/*! \brief File internal state of the decoding.
+ */
+static unsigned long counts_per_frame;
+static unsigned long long now, phase_start, last_frame;
+static unsigned long isrs, phase_isrs;
+static uint8_t last_frame_byte, last_isrs;
+static uint8_t started;
+static uint8_t effect = UNKNOWN_EFFECT;
+static uint8_t displaying;
+static unsigned long num_events;
+
+/*! \brief File internal function that ends the current compute or
+ *         display phase and starts the other.
+ */
+static void end_phase(void)
+{
+    unsigned long long t;
+    unsigned bin;
+
+    t = now - phase_start;
+    if (displaying) {
+        effects[effect].display += t;
+    } else {
+        effects[effect].compute += t;
+        if (t > effects[effect].compute_max) {
+            effects[effect].compute_max = t;
+        }
+        effects[effect].frames++;
+        effects[effect].isrs += isrs - phase_isrs;
+        bin = t * 8 / counts_per_frame;
+        effects[effect].bins[bin < NUM_BINS ? bin : NUM_BINS - 1]++;
+    }
+    displaying = !displaying;
+    phase_start = now;
+    phase_isrs = isrs;
+}
+
+/*! \brief File internal function that decodes an event.
+ *
+ *  The frame and interrupt counts wrap, so events must be less than
+ *  256 frames and interrupts apart.
+ */
+static void decode(const uint8_t *bytes)
+{
+    uint8_t id, kind, arg;
+    unsigned long long t;
+
+    id = bytes[0];
+    kind = TRACE_KIND(id);
+    arg = TRACE_ARG(id);
+    if (!started) {
+        last_frame_byte = bytes[1];
+        last_isrs = bytes[4];
+        started = 1;
+    }
+    last_frame += (uint8_t)(bytes[1] - last_frame_byte);
+    last_frame_byte = bytes[1];
+    isrs += (uint8_t)(bytes[4] - last_isrs);
+    last_isrs = bytes[4];
+    t = last_frame * counts_per_frame + (bytes[2] | bytes[3] << 8);
+    // Timer 1 may have been cleared before the frame was counted
+    while (t < now) {
+        t += counts_per_frame;
+    }
+    now = t;
+    if (num_events == 0) {
+        phase_start = now;
+        phase_isrs = isrs;
+    }
+    num_events++;
+
+    switch (kind) {
+    case TRACE_EFFECT_START:
+        effect = arg < MAX_EFFECTS ? arg : UNKNOWN_EFFECT;
+        displaying = 0;
+        phase_start = now;
+        phase_isrs = isrs;
+        break;
+    case TRACE_EFFECT_END:
+        end_phase();
+        effect = UNKNOWN_EFFECT;
+        break;
+    case TRACE_COMPUTE_END:
+        if (!displaying) {
+            end_phase();
+        }
+        break;
+    case TRACE_DISPLAY_END:
+        if (displaying) {
+            end_phase();
+        }
+        break;
+    case TRACE_ENTER:
+        if (arg < TRACE_NUM_PRIMITIVES && !primitives[arg].depth++) {
+            primitives[arg].entered = now;
+        }
+        break;
+    case TRACE_LEAVE:
+        if (arg < TRACE_NUM_PRIMITIVES && primitives[arg].depth &&
+            !--primitives[arg].depth) {
+            t = now - primitives[arg].entered;
+            primitives[arg].calls++;
+            primitives[arg].total += t;
+            if (t > primitives[arg].max) {
+                primitives[arg].max = t;
+            }
+        }
+        break;
+    }
+}
+
+/*! \brief File internal conversion from timer 1 counts to cycles.
+ */
+static double cycles(unsigned long long counts)
+{
+    return counts * 8.0;
+}
+
+static void report(void)
+{
+    unsigned long long total;
+    unsigned i, j;
+
+    printf("%lu events, %.1f ms\n", num_events,
+           cycles(now) * 1000 / f_cpu);
+    for (i = 0; i <= MAX_EFFECTS; i++) {
+        total = effects[i].compute + effects[i].display;
+        if (!total) {
+            continue;
+        }
+        if (i == UNKNOWN_EFFECT) {
+            printf("unknown effect:");
+        } else {
+            printf("effect %u:", i);
+        }
+        printf(" %lu frames, compute %.1f%%, display %.1f%%\n",
+               effects[i].frames, 100.0 * effects[i].compute / total,
+               100.0 * effects[i].display / total);
+        if (!effects[i].frames) {
+            continue;
+        }
+        printf("  compute per frame: mean %.0f cycles, max %.0f cycles\n",
+               cycles(effects[i].compute) / effects[i].frames,
+               cycles(effects[i].compute_max));
+        printf("  interrupts while computing: %.2f per frame",
+               (double)effects[i].isrs / effects[i].frames);
+        if (isr_cycles) {
+            printf(", about %.0f cycles", isr_cycles * effects[i].isrs /
+                   effects[i].frames);
+        }
+        printf("\n  compute time, in eighths of a frame:\n");
+        for (j = 0; j < NUM_BINS; j++) {
+            if (j < NUM_BINS - 1) {
+                printf("    %u/8 %8lu\n", j, effects[i].bins[j]);
+            } else {
+                printf("    >=1 %8lu (late)\n", effects[i].bins[j]);
+            }
+        }
+    }
+    for (i = 0; i < TRACE_NUM_PRIMITIVES; i++) {
+        if (primitives[i].calls) {
+            printf("%s: %lu calls, mean %.0f cycles, max %.0f cycles\n",
+                   primitive_names[i], primitives[i].calls,
+                   cycles(primitives[i].total) / primitives[i].calls,
+                   cycles(primitives[i].max));
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    FILE *f;
+    uint8_t event[TRACE_EVENT_SIZE];
+    uint8_t *dump;
+    long size;
+    unsigned n, head, i;
+    uint8_t is_dump;
+    int opt;
+
+    is_dump = 0;
+    while ((opt = getopt(argc, argv, "dr:f:i:")) != -1) {
+        switch (opt) {
+        case 'd':
+            is_dump = 1;
+            break;
+        case 'r':
+            frame_rate = strtoul(optarg, 0, 10);
+            break;
+        case 'f':
+            f_cpu = strtoul(optarg, 0, 10);
+            break;
+        case 'i':
+            isr_cycles = strtod(optarg, 0);
+            break;
+        default:
+            goto usage;
+        }
+    }
+    if (optind + 1 != argc) {
+        goto usage;
+    }
+    counts_per_frame = f_cpu / 8 / frame_rate;
+    f = fopen(argv[optind], "rb");
+    if (!f) {
+        perror(argv[optind]);
+        return 1;
+    }
+
+    if (is_dump) {
+        fseek(f, 0, SEEK_END);
+        size = ftell(f);
+        rewind(f);
+        n = size > 2 ? (size - 2) / TRACE_EVENT_SIZE : 0;
+        dump = malloc(size > 0 ? size : 1);
+        if (!n || fread(dump, size, 1, f) != 1 || dump[0] >= n) {
+            fprintf(stderr, "%s: %s is not a trace dump\n", argv[0],
+                    argv[optind]);
+            return 1;
+        }
+        head = dump[0];
+        for (i = 0; i < n; i++) {
+            memcpy(event, dump + 2 + (head + i) % n * TRACE_EVENT_SIZE,
+                   TRACE_EVENT_SIZE);
+            // Unused entries are still zero
+            if (event[0] | event[1] | event[2] | event[3] | event[4]) {
+                decode(event);
+            }
+        }
+        free(dump);
+    } else {
+        while (fread(event, TRACE_EVENT_SIZE, 1, f) == 1) {
+            decode(event);
+        }
+    }
+    fclose(f);
+    report();
+    return 0;
+
+usage:
+    fprintf(stderr, "usage: %s [-d] [-r rate] [-f hz] [-i cycles] file\n",
+            argv[0]);
+    return 1;
+}
+
+/*! @} */
@@ -0,0 +1,165 @@
+#include "hal.h"
+
+#include "wave.h"
+#include "led.h"
+#include "blink_kit.h"
+#include "trace.h"
+
+/*! \addtogroup wave
+ *  @{
+ */
+
+/*! \brief File internal table of the first quarter period of a sine.
+ *
+ *  Entry i is 128 sin(2 pi (i + 0.5) / 256), rounded down and
+ *  limited to 127. The other quarters are mirrored from it. The table
+ *  is stored in flash.
+ */
+static const uint8_t sine_table[64] PROGMEM =
+{
+    1, 4, 7, 10, 14, 17, 20, 23, 26, 29, 32, 35, 38, 41, 44, 47,
+    50, 53, 56, 58, 61, 64, 67, 69, 72, 74, 77, 79, 82, 84, 87, 89,
+    91, 93, 95, 97, 99, 101, 103, 105, 107, 108, 110, 112, 113, 115, 116, 117,
+    118, 119, 121, 122, 122, 123, 124, 125, 125, 126, 126, 127, 127, 127, 127, 127
+};
+
+/*! \brief File internal table of an exponential curve.
+ *
+ *  Entry i is 255 (2^(5 i / 63) - 1) / 31, rounded, so it goes from 0
+ *  to 255 over five doublings. Values between the entries are
+ *  interpolated, and the last entry is repeated for that. The table
+ *  is stored in flash.
+ */
+static const uint8_t exp_table[65] PROGMEM =
+{
+    0, 0, 1, 1, 2, 3, 3, 4, 5, 5, 6, 7, 8, 9, 10, 11,
+    12, 13, 14, 15, 16, 18, 19, 21, 23, 24, 26, 28, 30, 32, 35, 37,
+    40, 42, 45, 48, 51, 55, 58, 62, 66, 70, 75, 79, 84, 90, 95, 101,
+    107, 114, 121, 128, 135, 144, 152, 161, 171, 181, 192, 203, 215, 228, 241, 255,
+    255
+};
+
+/*! \brief File internal function that gets a sample of a sine wave.
+ */
+static inline uint8_t sine(uint8_t phase)
+{
+    uint8_t i;
+    uint8_t x;
+
+    i = phase & 63;
+    if (phase & 64) {
+        i = 63 - i;
+    }
+    x = pgm_read_byte(&sine_table[i]);
+    return (phase & 128) ? 127 - x : 128 + x;
+}
+
+/*! \brief File internal function that looks up a sample on the
+ *         exponential curve.
+ *
+ *  The two low bits interpolate between the table entries, with
+ *  shifts instead of a multiplication.
+ */
+static inline uint8_t exponential(uint8_t x)
+{
+    uint8_t i;
+    uint8_t y, step;
+
+    i = x >> 2;
+    y = pgm_read_byte(&exp_table[i]);
+    step = pgm_read_byte(&exp_table[i + 1]) - y;
+    if (x & 2) {
+        y += step >> 1;
+    }
+    if (x & 1) {
+        y += step >> 2;
+    }
+    return y;
+}
+
+/*! \brief Get a sample of a wave shape.
+ *
+ *  \param shape One of #wave_shape.
+ *  \param phase The phase, in 1/256 periods.
+ *  \return The sample, from 0 to 255.
+ */
+uint8_t wave_sample(uint8_t shape, uint8_t phase)
+{
+    switch (shape) {
+    case WAVE_TRIANGLE:
+        // Rises through 128 at phase 0, like the sine
+        phase += 64;
+        return (phase & 128) ? ~(phase << 1) : phase << 1;
+    case WAVE_EXP:
+        return exponential(sine(phase));
+    default:
+        return sine(phase);
+    }
+}
+
+/*! \brief Move waves forward by their speeds.
+ *
+ *  Typically called once for each frame shown.
+ *
+ *  \param waves An array of n waves.
+ *  \param n The number of waves.
+ */
+void wave_step(struct wave* waves, uint8_t n)
+{
+    uint8_t j;
+
+    for (j = 0; j < n; j++) {
+        waves[j].phase += waves[j].speed;
+    }
+}
+
+/*! \brief Draw the sum of some waves into the led array.
+ *
+ *  The samples of the waves at each LED are added up and scaled down
+ *  by the number of waves, rounded up to a power of two (so three
+ *  waves peak at 3/4 of #MAX_INTENSITY). The sum is then scaled to a
+ *  level with #BYTE_TO_LEVEL. With #LED_DITHER the fraction of the
+ *  level is kept, otherwise the intensity is rounded.
+ *
+ *  The phase of each wave is stepped by its spread from one LED to
+ *  the next, so the whole array is drawn in a single pass.
+ *
+ *  \param waves An array of n waves.
+ *  \param n The number of waves, from 1 to #WAVE_MAX_LAYERS.
+ */
+void wave_render(const struct wave* waves, uint8_t n)
+{
+    uint8_t phases[WAVE_MAX_LAYERS];
+    uint8_t* a;
+    uint8_t led, j;
+    uint8_t shift;
+    uint16_t sum;
+    uint8_t x;
+    uint16_t level;
+
+    TRACE_EVENT(TRACE_ENTER, TRACE_WAVE_RENDER);
+    a = get_led_array();
+    for (j = 0; j < n; j++) {
+        phases[j] = waves[j].phase >> 8;
+    }
+    shift = n > 2 ? 2 : n - 1;
+
+    for (led = 0; led < NUM_LEDS; led++) {
+        sum = 0;
+        for (j = 0; j < n; j++) {
+            sum += wave_sample(waves[j].shape, phases[j]);
+            phases[j] += waves[j].spread;
+        }
+        x = sum >> shift;
+        level = BYTE_TO_LEVEL(x);
+#if LED_DITHER
+        a[led] = level >> 8;
+        a[NUM_LEDS + led] = level;
+#else
+        a[led] = (level + 0x80) >> 8;
+#endif
+    }
+    TRACE_EVENT(TRACE_LEAVE, TRACE_WAVE_RENDER);
+}
+
+/*! @} */
@@ -0,0 +1,61 @@
+#ifndef WAVE_H
+#define WAVE_H
+
+#include <stdint.h>
+
+/*! \defgroup wave Wave
+ *  \brief Table driven waves across the LED array
+ *
+ *  A wave is a periodic shape with a phase accumulator. The phase of
+ *  LED i is the phase of the wave plus i times its spread, so a wave
+ *  with a spread travels along the array as its phase moves, and a
+ *  wave without one makes all LEDs breathe together. #wave_render
+ *  sums up to #WAVE_MAX_LAYERS waves into the led array in one pass,
+ *  which gives plasma like patterns from a few sine waves of
+ *  different spreads and speeds.
+ *
+ *  The shapes are read from tables in flash, and the phases are only
+ *  ever added to, so a frame takes no multiplication or division.
+ *
+ *  A phase is in 1/256 of a period, or 1/65536 in the phase
+ *  accumulator. All shapes peak at phase 64 and bottom out at phase
+ *  192.
+ */
+
+/*! \addtogroup wave
+ *  @{
+ */
+
+/*! \brief The most waves #wave_render sums up.
+ */
+#define WAVE_MAX_LAYERS 4
+
+/*! \brief The shapes of a wave.
+ *
+ *  WAVE_EXP is the sine wave through an exponential curve, which
+ *  looks like breathing: a short bright peak and a long dark trough.
+ */
+enum wave_shape {
+    WAVE_SINE,
+    WAVE_TRIANGLE,
+    WAVE_EXP
+};
+
+/*! \brief A wave, or a layer of a pattern.
+ */
+struct wave {
+    uint16_t phase;     //!< Phase of LED 0, in 1/65536 periods
+    int16_t speed;      //!< Added to phase by #wave_step
+    int8_t spread;      //!< Phase of LED i + 1 minus that of LED i
+    uint8_t shape;      //!< One of #wave_shape
+};
+
+uint8_t wave_sample(uint8_t shape, uint8_t phase);
+
+void wave_step(struct wave* waves, uint8_t n);
+
+void wave_render(const struct wave* waves, uint8_t n);
+
+/*! @} */
+
+#endif